@@ -14,7 +14,7 @@ echo Calling vcvars64.bat...
 call "%VS_PATH%" > nul
 
 echo Building DK Server (Release Mode)...
-cl /EHsc /std:c++latest /O2 /I src /I vendor\vcpkg\installed\x64-windows\include src\main.cpp src\sys\WindowsIOCP.cpp src\core\BufferPool.cpp src\http\Parser.cpp /link /out:server.exe /LIBPATH:vendor\vcpkg\installed\x64-windows\lib ws2_32.lib mswsock.lib libssl.lib libcrypto.lib crypt32.lib user32.lib advapi32.lib
+cl /EHsc /std:c++latest /O2 /I src /I vendor\vcpkg\installed\x64-windows\include src\main.cpp src\sys\WindowsIOCP.cpp src\core\BufferPool.cpp src\http\Parser.cpp src\http\Scan.cpp /link /out:server.exe /LIBPATH:vendor\vcpkg\installed\x64-windows\lib ws2_32.lib mswsock.lib libssl.lib libcrypto.lib crypt32.lib user32.lib advapi32.lib
 
 if %ERRORLEVEL% EQU 0 (
     echo.
@@ -1,6 +1,7 @@
 #pragma once
 #include "../http/Router.hpp"
 #include "../http/Json.hpp"
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -40,7 +41,46 @@ public:
             }
             return res;
         });
+
+        // Bulk import: one JSON user per line, in a body of any size. The body
+        // is streamed, so lines are counted as they go past.
+        router.add_stream(http::Method::HTTP_POST, "/api/users/import", [](const http::Request&) {
+            return std::make_unique<ImportSink>();
+        });
     }
+
+private:
+    class ImportSink : public http::BodySink {
+    public:
+        void write(std::string_view piece) override {
+            for (char c : piece) {
+                if (c == '\n') {
+                    if (m_line_bytes > 0) m_users++;
+                    m_line_bytes = 0;
+                } else {
+                    m_line_bytes++;
+                }
+            }
+            m_bytes += piece.size();
+        }
+
+        http::Response finish() override {
+            if (m_line_bytes > 0) m_users++;
+            http::Response res;
+            res.content_type = "application/json";
+            res.body = http::Json::serialize({
+                {"message", "Users imported"},
+                {"users", std::to_string(m_users)},
+                {"bytes", std::to_string(m_bytes)}
+            });
+            return res;
+        }
+
+    private:
+        size_t m_users = 0;
+        size_t m_bytes = 0;
+        size_t m_line_bytes = 0;
+    };
 };
 
 }
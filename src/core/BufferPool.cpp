@@ -1,45 +1,509 @@
 #include "BufferPool.hpp"
-#include <stdexcept>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #ifdef __linux__
+        #include <sys/syscall.h>
+        #include <linux/mempolicy.h>
+    #endif
+#endif
 
 namespace core {
 
-BufferPool::BufferPool(size_t block_count) {
-    m_memory.resize(block_count * BLOCK_SIZE);
-    m_free_indices.reserve(block_count);
-    m_blocks.reserve(block_count);
+namespace {
+
+constexpr size_t MAGAZINE_SIZE = 32;
+
+struct SlabHeader {
+    BufferPool::Depot* depot;
+    unsigned cls;
+    uint32_t* stamps; // Allocation time per block (us), nullptr unless tracking lifetimes
+};
+
+// Slab headers live here rather than in the slabs, so carving a slab touches
+// none of its memory (under THP, writing a header would fault in and zero a
+// whole huge page). Two levels indexed by slab number over a 48-bit address
+// space; leaves are added as slabs are mapped and never freed.
+class SlabMap {
+public:
+    static constexpr unsigned SLAB_BITS = 21;
+    static constexpr unsigned LEAF_BITS = 14;
+    static constexpr unsigned ROOT_BITS = 48 - SLAB_BITS - LEAF_BITS;
+    static_assert(size_t{1} << SLAB_BITS == BufferPool::SLAB_SIZE);
+
+    SlabHeader* find(const void* ptr) const {
+        uintptr_t n = reinterpret_cast<uintptr_t>(ptr) >> SLAB_BITS;
+        Leaf* leaf = m_root[n >> LEAF_BITS].load(std::memory_order_acquire);
+        return leaf->slabs[n & LEAF_MASK].load(std::memory_order_acquire);
+    }
+
+    // False if `base` lies outside the address space the map covers
+    bool set(const void* base, SlabHeader* header) {
+        uintptr_t n = reinterpret_cast<uintptr_t>(base) >> SLAB_BITS;
+        if (n >> (ROOT_BITS + LEAF_BITS)) return false;
+        std::atomic<Leaf*>& slot = m_root[n >> LEAF_BITS];
+        Leaf* leaf = slot.load(std::memory_order_acquire);
+        if (!leaf) {
+            std::lock_guard<std::mutex> guard(m_lock);
+            leaf = slot.load(std::memory_order_relaxed);
+            if (!leaf) {
+                leaf = new Leaf{};
+                slot.store(leaf, std::memory_order_release);
+            }
+        }
+        leaf->slabs[n & LEAF_MASK].store(header, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static constexpr uintptr_t LEAF_MASK = (uintptr_t{1} << LEAF_BITS) - 1;
+
+    struct Leaf {
+        std::array<std::atomic<SlabHeader*>, size_t{1} << LEAF_BITS> slabs{};
+    };
+
+    std::array<std::atomic<Leaf*>, size_t{1} << ROOT_BITS> m_root{};
+    std::mutex m_lock;
+};
+
+SlabMap g_slab_map;
+
+SlabHeader* slab_of(const void* ptr) {
+    return g_slab_map.find(ptr);
+}
+
+uintptr_t slab_base(const void* ptr) {
+    return reinterpret_cast<uintptr_t>(ptr) & ~(uintptr_t(BufferPool::SLAB_SIZE) - 1);
+}
+
+std::atomic<bool> g_warned_huge{ false };
+
+void warn_no_huge_pages() {
+    if (!g_warned_huge.exchange(true, std::memory_order_relaxed)) {
+        std::cerr << "[BufferPool] Explicit huge pages unavailable, falling back to regular pages\n";
+    }
+}
+
+struct Slab {
+    void* base = nullptr;
+    void* mapping = nullptr; // What to hand back to the OS
+    size_t mapping_len = 0;
+    bool huge = false;
+    uint32_t* stamps = nullptr;
+    SlabHeader* header = nullptr;
+};
+
+#ifdef _WIN32
+
+void* commit(void* addr, size_t len, int node) {
+    if (node >= 0) {
+        return VirtualAllocExNuma(GetCurrentProcess(), addr, len, MEM_COMMIT, PAGE_READWRITE, static_cast<DWORD>(node));
+    }
+    return VirtualAlloc(addr, len, MEM_COMMIT, PAGE_READWRITE);
+}
+
+Slab map_slab(const BufferPoolOptions& options) {
+    constexpr size_t SLAB_SIZE = BufferPool::SLAB_SIZE;
+    Slab slab;
+
+    if (options.huge_pages == HugePages::Explicit) {
+        // Large pages are aligned to their own size and committed up front
+        size_t large = GetLargePageMinimum();
+        DWORD type = MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES;
+        void* mem = nullptr;
+        if (large > 0 && SLAB_SIZE % large == 0) {
+            mem = options.numa_node >= 0
+                ? VirtualAllocExNuma(GetCurrentProcess(), nullptr, SLAB_SIZE, type, PAGE_READWRITE, static_cast<DWORD>(options.numa_node))
+                : VirtualAlloc(nullptr, SLAB_SIZE, type, PAGE_READWRITE);
+        }
+        if (mem) return Slab{ mem, mem, SLAB_SIZE, true };
+        warn_no_huge_pages();
+    }
+
+    // Reserve twice the size to find an aligned window, then commit only that window
+    void* reservation = VirtualAlloc(nullptr, 2 * SLAB_SIZE, MEM_RESERVE, PAGE_NOACCESS);
+    if (!reservation) return slab;
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(reservation) + SLAB_SIZE - 1) & ~(uintptr_t(SLAB_SIZE) - 1);
+    if (!commit(reinterpret_cast<void*>(aligned), SLAB_SIZE, options.numa_node)) {
+        VirtualFree(reservation, 0, MEM_RELEASE);
+        return slab;
+    }
+    return Slab{ reinterpret_cast<void*>(aligned), reservation, 2 * SLAB_SIZE, false };
+}
+
+void unmap_slab(const Slab& slab) {
+    VirtualFree(slab.mapping, 0, MEM_RELEASE);
+}
+
+#else
+
+void bind_to_node(void* addr, size_t len, int node) {
+#ifdef __linux__
+    // Preferred rather than strict: fall back to other nodes instead of failing under pressure
+    unsigned long mask[4] = {};
+    if (node < 0 || node >= static_cast<int>(sizeof(mask) * 8)) return;
+    mask[node / (sizeof(unsigned long) * 8)] |= 1UL << (node % (sizeof(unsigned long) * 8));
+    syscall(SYS_mbind, addr, len, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+#else
+    (void)addr; (void)len; (void)node;
+#endif
+}
+
+Slab map_slab(const BufferPoolOptions& options) {
+    constexpr size_t SLAB_SIZE = BufferPool::SLAB_SIZE;
+    Slab slab;
+
+#ifdef MAP_HUGETLB
+    if (options.huge_pages == HugePages::Explicit) {
+        // hugetlbfs mappings are aligned to the (2 MiB) huge page size
+        void* mem = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (mem != MAP_FAILED) {
+            bind_to_node(mem, SLAB_SIZE, options.numa_node);
+            return Slab{ mem, mem, SLAB_SIZE, true };
+        }
+        warn_no_huge_pages();
+    }
+#endif
+
+    // Map twice the size and trim to an aligned window. Anonymous memory is
+    // only backed as it is touched, so nothing is committed or zeroed here.
+    void* mem = mmap(nullptr, 2 * SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) return slab;
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(mem);
+    uintptr_t aligned = (start + SLAB_SIZE - 1) & ~(uintptr_t(SLAB_SIZE) - 1);
+    if (aligned > start) munmap(mem, aligned - start);
+    if (aligned + SLAB_SIZE < start + 2 * SLAB_SIZE) {
+        munmap(reinterpret_cast<void*>(aligned + SLAB_SIZE), start + 2 * SLAB_SIZE - (aligned + SLAB_SIZE));
+    }
+
+    void* base = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+    if (options.huge_pages != HugePages::None) {
+        madvise(base, SLAB_SIZE, MADV_HUGEPAGE);
+    }
+#endif
+    bind_to_node(base, SLAB_SIZE, options.numa_node);
+    return Slab{ base, base, SLAB_SIZE, false };
+}
+
+void unmap_slab(const Slab& slab) {
+    munmap(slab.mapping, slab.mapping_len);
+}
+
+#endif
+
+struct Magazine {
+    size_t count = 0;
+    void* blocks[MAGAZINE_SIZE];
+};
+
+std::atomic<uint64_t> g_next_depot_id{ 1 };
+
+}
+
+struct BufferPool::Depot {
+    struct Class {
+        std::mutex lock;
+        std::vector<void*> free;
+        size_t blocks = 0;
+    };
+
+    // Kept apart from Class so counting doesn't contend with the free-list lock
+    struct alignas(64) Counters {
+        std::atomic<uint64_t> allocations{ 0 };
+        std::atomic<uint64_t> frees{ 0 };
+        std::atomic<uint64_t> failures{ 0 };
+        std::atomic<uint64_t> high_water{ 0 };
+        std::array<std::atomic<uint64_t>, LIFETIME_BUCKETS> lifetimes{};
+    };
+
+    const uint64_t id = g_next_depot_id.fetch_add(1, std::memory_order_relaxed);
+    const BufferPoolOptions options;
+    std::atomic<size_t> reserved{ 0 };
+
+    mutable std::mutex slabs_lock;
+    std::vector<Slab> slabs;
+    size_t huge_slabs = 0;
+
+    std::array<Class, CLASS_COUNT> classes;
+    std::array<Counters, CLASS_COUNT> counters;
+    std::atomic<uint64_t> oversize{ 0 };
+    std::atomic<bool> warned_exhausted{ false };
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    explicit Depot(const BufferPoolOptions& opts) : options(opts) {}
 
-    for (size_t i = 0; i < block_count; ++i) {
-        m_blocks.push_back(m_memory.data() + (i * BLOCK_SIZE));
-        m_free_indices.push_back(i);
+    ~Depot() {
+        for (const Slab& slab : slabs) {
+            g_slab_map.set(slab.base, nullptr);
+            delete slab.header;
+            delete[] slab.stamps;
+            unmap_slab(slab);
+        }
+    }
+
+    uint32_t now_us() const {
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+        return static_cast<uint32_t>(us); // Wraps every ~71 minutes; lifetimes are taken modulo 2^32
+    }
+
+    void on_allocate(unsigned cls, void* block) {
+        Counters& c = counters[cls];
+        uint64_t allocated = c.allocations.fetch_add(1, std::memory_order_relaxed) + 1;
+        uint64_t in_use = allocated - c.frees.load(std::memory_order_relaxed);
+        uint64_t high = c.high_water.load(std::memory_order_relaxed);
+        while (in_use > high && !c.high_water.compare_exchange_weak(high, in_use, std::memory_order_relaxed)) {
+        }
+
+        SlabHeader* slab = slab_of(block);
+        if (slab->stamps) slab->stamps[block_index(slab, block)] = now_us();
+    }
+
+    void on_deallocate(SlabHeader* slab, void* block) {
+        Counters& c = counters[slab->cls];
+        c.frees.fetch_add(1, std::memory_order_relaxed);
+        if (slab->stamps) {
+            uint32_t held = now_us() - slab->stamps[block_index(slab, block)];
+            unsigned bucket = std::min<unsigned>(std::bit_width(held >> 4), LIFETIME_BUCKETS - 1);
+            c.lifetimes[bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void on_failure(unsigned cls) {
+        counters[cls].failures.fetch_add(1, std::memory_order_relaxed);
+        if (!warned_exhausted.exchange(true, std::memory_order_relaxed)) {
+            std::cerr << "[BufferPool] Exhausted: no " << class_size(cls) << " B block available"
+                      << " (" << reserved.load(std::memory_order_relaxed) / (1024 * 1024) << " MiB reserved)\n";
+        }
+    }
+
+    static size_t block_index(const SlabHeader* slab, const void* block) {
+        return (reinterpret_cast<uintptr_t>(block) - slab_base(block)) / class_size(slab->cls);
+    }
+
+    // Carves a new slab into `cls`. Caller holds classes[cls].lock.
+    bool grow(unsigned cls) {
+        size_t max_bytes = options.max_bytes;
+        if (max_bytes > 0 && reserved.fetch_add(SLAB_SIZE) + SLAB_SIZE > max_bytes) {
+            reserved.fetch_sub(SLAB_SIZE);
+            return false;
+        }
+        if (max_bytes == 0) reserved.fetch_add(SLAB_SIZE);
+
+        Slab slab = map_slab(options);
+        if (!slab.base) {
+            reserved.fetch_sub(SLAB_SIZE);
+            return false;
+        }
+        if (options.track_lifetimes) {
+            slab.stamps = new uint32_t[SLAB_SIZE / class_size(cls)];
+        }
+        slab.header = new SlabHeader{ this, cls, slab.stamps };
+        if (!g_slab_map.set(slab.base, slab.header)) {
+            delete slab.header;
+            delete[] slab.stamps;
+            unmap_slab(slab);
+            reserved.fetch_sub(SLAB_SIZE);
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> guard(slabs_lock);
+            slabs.push_back(slab);
+            if (slab.huge) huge_slabs++;
+        }
+
+        // Pushed high to low so the lowest addresses are handed out first.
+        // Nothing is written to the slab: its pages stay untouched until used.
+        std::byte* base = static_cast<std::byte*>(slab.base);
+        size_t size = class_size(cls);
+        Class& c = classes[cls];
+        for (size_t off = SLAB_SIZE; off > 0; off -= size) {
+            c.free.push_back(base + off - size);
+            c.blocks++;
+        }
+        return true;
+    }
+
+    bool refill(unsigned cls, Magazine& mag) {
+        Class& c = classes[cls];
+        std::lock_guard<std::mutex> guard(c.lock);
+        if (c.free.empty() && !grow(cls)) return false;
+
+        size_t n = std::min(MAGAZINE_SIZE / 2, c.free.size());
+        for (size_t i = 0; i < n; ++i) {
+            mag.blocks[mag.count++] = c.free.back();
+            c.free.pop_back();
+        }
+        return true;
+    }
+
+    void drain(unsigned cls, Magazine& mag, size_t n) {
+        Class& c = classes[cls];
+        std::lock_guard<std::mutex> guard(c.lock);
+        for (size_t i = 0; i < n && mag.count > 0; ++i) {
+            c.free.push_back(mag.blocks[--mag.count]);
+        }
+    }
+};
+
+namespace {
+
+struct CacheEntry {
+    uint64_t id;
+    std::weak_ptr<BufferPool::Depot> depot;
+    std::array<Magazine, BufferPool::CLASS_COUNT> mags;
+};
+
+// A thread's magazines, one set per pool it has touched. Blocks cached for a
+// pool that has since been destroyed are simply dropped.
+struct ThreadCache {
+    std::vector<std::unique_ptr<CacheEntry>> entries;
+    CacheEntry* last = nullptr;
+
+    CacheEntry& get(const std::shared_ptr<BufferPool::Depot>& depot) {
+        if (last && last->id == depot->id) return *last;
+
+        for (auto& e : entries) {
+            if (e->id == depot->id) return *(last = e.get());
+        }
+
+        last = nullptr;
+        std::erase_if(entries, [](const auto& e) { return e->depot.expired(); });
+        entries.push_back(std::make_unique<CacheEntry>(CacheEntry{ depot->id, depot, {} }));
+        return *(last = entries.back().get());
+    }
+
+    ~ThreadCache() {
+        for (auto& e : entries) {
+            if (auto depot = e->depot.lock()) {
+                for (unsigned cls = 0; cls < BufferPool::CLASS_COUNT; ++cls) {
+                    depot->drain(cls, e->mags[cls], MAGAZINE_SIZE);
+                }
+            }
+        }
+    }
+};
+
+thread_local ThreadCache t_cache;
+
+}
+
+BufferPool::BufferPool(size_t block_count, const BufferPoolOptions& options) : m_depot(std::make_shared<Depot>(options)) {
+    unsigned cls = size_class(BLOCK_SIZE);
+    Depot::Class& c = m_depot->classes[cls];
+    std::lock_guard<std::mutex> guard(c.lock);
+    while (c.blocks < block_count && m_depot->grow(cls)) {
     }
 }
 
-void* BufferPool::allocate() {
-    if (m_free_indices.empty()) {
+BufferPool::~BufferPool() = default;
+
+void* BufferPool::allocate(size_t bytes) {
+    if (bytes > MAX_BLOCK_SIZE) {
+        m_depot->oversize.fetch_add(1, std::memory_order_relaxed);
         return nullptr;
     }
-    size_t idx = m_free_indices.back();
-    m_free_indices.pop_back();
-    return m_blocks[idx];
+
+    unsigned cls = size_class(bytes);
+    Magazine& mag = t_cache.get(m_depot).mags[cls];
+    if (mag.count == 0 && !m_depot->refill(cls, mag)) {
+        m_depot->on_failure(cls);
+        return nullptr;
+    }
+    void* block = mag.blocks[--mag.count];
+    m_depot->on_allocate(cls, block);
+    return block;
 }
 
 void BufferPool::deallocate(void* ptr) {
-    // O(N) search to find index? No, we can calculate it.
-    // Assuming ptr is valid.
-    std::byte* p = static_cast<std::byte*>(ptr);
-    std::byte* start = m_memory.data();
-    
-    if (p < start || p >= start + m_memory.size()) {
-        return; // Invalid pointer
-    }
-    
-    size_t offset = p - start;
-    if (offset % BLOCK_SIZE != 0) {
-        return; // Misaligned
-    }
-    
-    size_t idx = offset / BLOCK_SIZE;
-    m_free_indices.push_back(idx);
+    if (!ptr) return;
+
+    SlabHeader* slab = slab_of(ptr);
+    unsigned cls = slab->cls;
+    slab->depot->on_deallocate(slab, ptr);
+    Magazine& mag = t_cache.get(m_depot).mags[cls];
+    if (mag.count == MAGAZINE_SIZE) {
+        m_depot->drain(cls, mag, MAGAZINE_SIZE / 2);
+    }
+    mag.blocks[mag.count++] = ptr;
+}
+
+size_t BufferPool::block_size(const void* ptr) {
+    return class_size(slab_of(ptr)->cls);
+}
+
+std::vector<std::span<std::byte>> BufferPool::regions() const {
+    std::lock_guard<std::mutex> guard(m_depot->slabs_lock);
+    std::vector<std::span<std::byte>> out;
+    out.reserve(m_depot->slabs.size());
+    for (const Slab& slab : m_depot->slabs) {
+        out.emplace_back(static_cast<std::byte*>(slab.base), SLAB_SIZE);
+    }
+    return out;
+}
+
+size_t BufferPool::reserved_bytes() const {
+    return m_depot->reserved.load(std::memory_order_relaxed);
+}
+
+size_t BufferPool::huge_page_slabs() const {
+    std::lock_guard<std::mutex> guard(m_depot->slabs_lock);
+    return m_depot->huge_slabs;
+}
+
+size_t BufferPool::capacity() const {
+    Depot::Class& c = m_depot->classes[size_class(BLOCK_SIZE)];
+    std::lock_guard<std::mutex> guard(c.lock);
+    return c.blocks;
+}
+
+size_t BufferPool::free_count() const {
+    Depot::Class& c = m_depot->classes[size_class(BLOCK_SIZE)];
+    std::lock_guard<std::mutex> guard(c.lock);
+    return c.free.size();
+}
+
+BufferPool::Stats BufferPool::stats() const {
+    Stats out;
+    for (unsigned cls = 0; cls < CLASS_COUNT; ++cls) {
+        ClassStats& cs = out.classes[cls];
+        const Depot::Counters& c = m_depot->counters[cls];
+        cs.block_size = class_size(cls);
+        cs.frees = c.frees.load(std::memory_order_relaxed);
+        cs.allocations = c.allocations.load(std::memory_order_relaxed);
+        cs.failures = c.failures.load(std::memory_order_relaxed);
+        cs.in_use = cs.allocations > cs.frees ? cs.allocations - cs.frees : 0;
+        cs.high_water = c.high_water.load(std::memory_order_relaxed);
+        for (unsigned b = 0; b < LIFETIME_BUCKETS; ++b) {
+            cs.lifetimes[b] = c.lifetimes[b].load(std::memory_order_relaxed);
+        }
+
+        Depot::Class& dc = m_depot->classes[cls];
+        std::lock_guard<std::mutex> guard(dc.lock);
+        cs.blocks = dc.blocks;
+        cs.depot_free = dc.free.size();
+    }
+    out.oversize = m_depot->oversize.load(std::memory_order_relaxed);
+    out.reserved_bytes = reserved_bytes();
+    out.max_bytes = m_depot->options.max_bytes;
+
+    std::lock_guard<std::mutex> guard(m_depot->slabs_lock);
+    out.slabs = m_depot->slabs.size();
+    out.huge_page_slabs = m_depot->huge_slabs;
+    return out;
 }
 
 }
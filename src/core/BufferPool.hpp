@@ -4,29 +4,116 @@
 #include <cstdint>
 #include <span>
 #include <memory>
+#include <array>
 
 namespace core {
 
+enum class HugePages {
+    None,
+    Transparent, // Advise THP on every slab (Linux); plain pages elsewhere
+    Explicit     // hugetlbfs pages (reserve them via vm.nr_hugepages) or Windows large
+                 // pages (needs SeLockMemoryPrivilege); falls back to Transparent
+};
+
+struct BufferPoolOptions {
+    size_t max_bytes = 0; // Cap on slab memory (0 = no cap)
+    HugePages huge_pages = HugePages::Transparent;
+    int numa_node = -1;   // Place slab memory on this node (-1 = wherever it is first touched)
+    bool track_lifetimes = true; // Time every block from allocate() to deallocate() for stats()
+};
+
+// Slab allocator for I/O buffers. Blocks come in power-of-two size classes
+// from 256 B to 64 KiB, carved out of slabs aligned to their own size, so any
+// block maps back to its slab (and size class) by its slab number. Each thread
+// keeps a small magazine of free blocks per class in front of the pool's shared
+// depot, and the depot grows by whole slabs when a class runs dry. Slabs are
+// mapped straight from the OS and only backed by memory as they are touched;
+// their metadata is kept elsewhere, so carving a slab writes nothing into it.
 class BufferPool {
 public:
-    static constexpr size_t BLOCK_SIZE = 4096;
+    static constexpr size_t MIN_BLOCK_SIZE = 256;
+    static constexpr size_t MAX_BLOCK_SIZE = 64 * 1024;
+    static constexpr unsigned CLASS_COUNT = 9;
+    static constexpr size_t BLOCK_SIZE = 4096; // Default class: recv and provided buffers
+    static constexpr size_t SLAB_SIZE = 2 * 1024 * 1024;
 
-    explicit BufferPool(size_t block_count);
-    ~BufferPool() = default;
+    // Pre-carves `block_count` blocks of BLOCK_SIZE
+    explicit BufferPool(size_t block_count, const BufferPoolOptions& options = {});
+    ~BufferPool();
 
     BufferPool(const BufferPool&) = delete;
     BufferPool& operator=(const BufferPool&) = delete;
 
-    void* allocate();
+    void* allocate() { return allocate(BLOCK_SIZE); }
+    // Block from the smallest class that fits `bytes`. nullptr only if `bytes`
+    // exceeds MAX_BLOCK_SIZE or the pool can't grow any further.
+    void* allocate(size_t bytes);
+    // Any thread may free a block, not just the one that allocated it
     void deallocate(void* ptr);
 
-    size_t capacity() const { return m_blocks.size(); }
-    size_t free_count() const { return m_free_indices.size(); }
+    // Usable size of a block returned by allocate()
+    static size_t block_size(const void* ptr);
+
+    static constexpr unsigned size_class(size_t bytes) {
+        unsigned cls = 0;
+        while (class_size(cls) < bytes) cls++;
+        return cls;
+    }
+    static constexpr size_t class_size(unsigned cls) { return MIN_BLOCK_SIZE << cls; }
+
+    // Every slab allocated so far, e.g. for registering with the kernel
+    std::vector<std::span<std::byte>> regions() const;
+    size_t reserved_bytes() const;
+    size_t huge_page_slabs() const; // Slabs backed by explicit huge/large pages
+
+    size_t capacity() const;   // BLOCK_SIZE blocks carved so far
+    size_t free_count() const; // Of those, free in the depot (thread magazines not counted)
+
+    // Freed blocks are bucketed by how long they were in use: bucket 0 is
+    // under 16 us, each following one doubles, the last is open-ended
+    static constexpr unsigned LIFETIME_BUCKETS = 20;
+    static constexpr uint64_t lifetime_limit_us(unsigned bucket) { return 16ull << bucket; }
+
+    struct ClassStats {
+        size_t block_size = 0;
+        size_t blocks = 0;        // Carved from slabs so far
+        size_t depot_free = 0;    // Free in the depot (thread magazines not counted)
+        uint64_t allocations = 0;
+        uint64_t frees = 0;
+        uint64_t failures = 0;    // allocate() calls that returned nullptr
+        uint64_t in_use = 0;      // Handed out and not yet freed
+        uint64_t high_water = 0;  // Most blocks in use at once
+        std::array<uint64_t, LIFETIME_BUCKETS> lifetimes{};
+    };
+
+    struct Stats {
+        std::array<ClassStats, CLASS_COUNT> classes;
+        uint64_t oversize = 0;    // Requests above MAX_BLOCK_SIZE
+        size_t reserved_bytes = 0;
+        size_t max_bytes = 0;
+        size_t slabs = 0;
+        size_t huge_page_slabs = 0;
+
+        uint64_t allocations() const { return sum(&ClassStats::allocations); }
+        uint64_t failures() const { return sum(&ClassStats::failures) + oversize; }
+        uint64_t in_use() const { return sum(&ClassStats::in_use); }
+
+    private:
+        uint64_t sum(uint64_t ClassStats::* field) const {
+            uint64_t total = 0;
+            for (const ClassStats& c : classes) total += c.*field;
+            return total;
+        }
+    };
+
+    // Snapshot of the counters. Safe to call from any thread while the pool is in use;
+    // counters are read one at a time, so totals can be off by in-flight operations.
+    Stats stats() const;
+
+    struct Depot;
 
 private:
-    std::vector<std::byte> m_memory; 
-    std::vector<size_t> m_free_indices;
-    std::vector<void*> m_blocks; // Pointers to start of each block
+    std::shared_ptr<Depot> m_depot;
 };
 
 }
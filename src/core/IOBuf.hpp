@@ -0,0 +1,326 @@
+#pragma once
+#include "BufferPool.hpp"
+#include "../sys/Platform.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <new>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace core {
+
+// Chain of reference-counted slices. Appending or splitting a chain moves
+// references, not bytes: the storage behind a slice (a pool block, a heap
+// block, or a container handed over with adopt()) is freed when the last slice
+// pointing into it goes away. Only the unshared tail of the last slice is
+// ever written to, so a chain never changes bytes another chain can see.
+class IOBuf {
+    struct Storage {
+        std::atomic<uint32_t> refs{ 1 };
+        void (*release)(Storage*);
+        BufferPool* pool;
+
+        Storage(void (*r)(Storage*), BufferPool* p) : release(r), pool(p) {}
+    };
+
+    template <typename T>
+    struct Owned : Storage {
+        T value;
+        explicit Owned(T&& v) : Storage(&Owned::destroy, nullptr), value(std::move(v)) {}
+        static void destroy(Storage* s) { delete static_cast<Owned*>(s); }
+    };
+
+    struct Slice {
+        Storage* storage; // nullptr: borrowed, the caller keeps the bytes alive
+        char* data;
+        size_t len;
+        char* limit;      // End of the space after `data` we may write into, nullptr if read-only
+    };
+
+public:
+    // Appends smaller than this are copied into tail space instead of adding a slice
+    static constexpr size_t COPY_THRESHOLD = 512;
+
+    IOBuf() = default;
+    explicit IOBuf(BufferPool& pool) : m_pool(&pool) {}
+
+    IOBuf(IOBuf&& other) noexcept : m_pool(other.m_pool), m_slices(std::move(other.m_slices)), m_size(other.m_size) {
+        other.m_slices.clear();
+        other.m_size = 0;
+    }
+    IOBuf& operator=(IOBuf&& other) noexcept {
+        if (this != &other) {
+            clear();
+            m_pool = other.m_pool;
+            m_slices = std::move(other.m_slices);
+            m_size = other.m_size;
+            other.m_slices.clear();
+            other.m_size = 0;
+        }
+        return *this;
+    }
+    ~IOBuf() { clear(); }
+
+    // Sharing is explicit: clone() references the same bytes
+    IOBuf(const IOBuf&) = delete;
+    IOBuf& operator=(const IOBuf&) = delete;
+
+    IOBuf clone() const {
+        IOBuf copy;
+        copy.m_pool = m_pool;
+        copy.append(*this);
+        return copy;
+    }
+
+    // Refers to memory the caller keeps alive for as long as the chain (or
+    // anything split from it) exists; own() copies it out when that can't hold
+    static IOBuf wrap(const void* data, size_t len) {
+        IOBuf buf;
+        if (len > 0) buf.push(Slice{ nullptr, static_cast<char*>(const_cast<void*>(data)), len, nullptr });
+        return buf;
+    }
+
+    // Takes over a container with data()/size() (std::string, std::vector...)
+    template <typename T>
+    static IOBuf take(T&& container) {
+        IOBuf buf;
+        buf.adopt(std::forward<T>(container));
+        return buf;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t slice_count() const { return m_slices.size(); }
+    std::span<const char> slice(size_t i) const { return { m_slices[i].data, m_slices[i].len }; }
+    BufferPool* pool() const { return m_pool; }
+
+    void clear() {
+        for (Slice& s : m_slices) unref(s.storage);
+        m_slices.clear();
+        m_size = 0;
+    }
+
+    void append(const void* data, size_t len) {
+        const char* src = static_cast<const char*>(data);
+        while (len > 0) {
+            // Fill what is left of the tail before starting a new block
+            std::span<char> space = tail(tail_space() > 0 ? 1 : std::min(len, BufferPool::MAX_BLOCK_SIZE - sizeof(Storage)));
+            size_t n = std::min(len, space.size());
+            memcpy(space.data(), src, n);
+            commit(n);
+            src += n;
+            len -= n;
+        }
+    }
+
+    void append(std::string_view s) { append(s.data(), s.size()); }
+
+    void append(IOBuf&& other) {
+        if (other.empty()) return;
+        if (m_slices.empty() && !m_pool) m_pool = other.m_pool;
+        if (other.m_size < COPY_THRESHOLD && tail_space() >= other.m_size) {
+            for (const Slice& s : other.m_slices) append(s.data, s.len);
+            other.clear();
+            return;
+        }
+        for (Slice& s : other.m_slices) push(s);
+        other.m_slices.clear();
+        other.m_size = 0;
+    }
+
+    void append(const IOBuf& other) {
+        if (other.m_size < COPY_THRESHOLD && tail_space() >= other.m_size) {
+            for (const Slice& s : other.m_slices) append(s.data, s.len);
+            return;
+        }
+        for (const Slice& s : other.m_slices) {
+            if (s.storage) s.storage->refs.fetch_add(1, std::memory_order_relaxed);
+            push(Slice{ s.storage, s.data, s.len, nullptr });
+        }
+    }
+
+    template <typename T>
+    void adopt(T&& container) {
+        using Value = std::remove_cvref_t<T>;
+        if (container.size() == 0) return;
+        size_t bytes = container.size() * sizeof(*container.data());
+        if (bytes < COPY_THRESHOLD) {
+            append(container.data(), bytes);
+            return;
+        }
+        auto* owned = new Owned<Value>(Value(std::forward<T>(container)));
+        char* data = reinterpret_cast<char*>(owned->value.data());
+        push(Slice{ owned, data, bytes, nullptr });
+    }
+
+    // Writable space of at least `min` bytes at the end of the chain. Fill
+    // some of it and commit() what was written.
+    std::span<char> tail(size_t min) {
+        min = std::max<size_t>(min, 1);
+        if (tail_space() < min) {
+            if (!m_slices.empty() && m_slices.back().len == 0) {
+                unref(m_slices.back().storage);
+                m_slices.pop_back();
+            }
+            push(allocate(min));
+        }
+        Slice& s = m_slices.back();
+        return { s.data + s.len, static_cast<size_t>(s.limit - (s.data + s.len)) };
+    }
+
+    void commit(size_t n) {
+        m_slices.back().len += n;
+        m_size += n;
+    }
+
+    // Drops `n` bytes from the front
+    void trim_front(size_t n) {
+        n = std::min(n, m_size);
+        m_size -= n;
+        size_t drop = 0;
+        while (n > 0) {
+            Slice& s = m_slices[drop];
+            if (n < s.len) {
+                s.data += n;
+                s.len -= n;
+                break;
+            }
+            n -= s.len;
+            unref(s.storage);
+            drop++;
+        }
+        m_slices.erase(m_slices.begin(), m_slices.begin() + drop);
+    }
+
+    // Moves the first `n` bytes into a new chain; a slice cut in two is shared
+    IOBuf split(size_t n) {
+        IOBuf front;
+        front.m_pool = m_pool;
+        n = std::min(n, m_size);
+        size_t take = 0;
+        while (n > 0) {
+            Slice& s = m_slices[take];
+            if (n < s.len) {
+                if (s.storage) s.storage->refs.fetch_add(1, std::memory_order_relaxed);
+                front.push(Slice{ s.storage, s.data, n, nullptr });
+                s.data += n;
+                s.len -= n;
+                break;
+            }
+            front.push(Slice{ s.storage, s.data, s.len, nullptr });
+            n -= s.len;
+            take++;
+        }
+        m_slices.erase(m_slices.begin(), m_slices.begin() + take);
+        m_size -= front.m_size;
+        return front;
+    }
+
+    // Copies up to `len` bytes from the front without consuming them
+    size_t copy_to(void* dst, size_t len) const {
+        char* out = static_cast<char*>(dst);
+        size_t done = 0;
+        for (const Slice& s : m_slices) {
+            if (done == len) break;
+            size_t n = std::min(len - done, s.len);
+            memcpy(out + done, s.data, n);
+            done += n;
+        }
+        return done;
+    }
+
+    // Makes the chain a single contiguous slice, copying only if it has more than one
+    std::span<const char> coalesce() {
+        if (m_slices.size() > 1) {
+            Slice joined = allocate(m_size);
+            copy_to(joined.data, m_size);
+            joined.len = m_size;
+            clear();
+            push(joined);
+        }
+        if (m_slices.empty()) return {};
+        return { m_slices[0].data, m_slices[0].len };
+    }
+
+    // Copies borrowed slices (see wrap()) into storage the chain owns
+    void own() {
+        if (std::none_of(m_slices.begin(), m_slices.end(), [](const Slice& s) { return s.storage == nullptr; })) return;
+
+        IOBuf owned;
+        owned.m_pool = m_pool;
+        for (Slice& s : m_slices) {
+            if (s.storage) {
+                owned.push(s);
+            } else {
+                owned.append(s.data, s.len);
+            }
+        }
+        m_slices.clear();
+        m_size = 0;
+        *this = std::move(owned);
+    }
+
+    // Fills up to `max` iovecs from the front of the chain and returns how many
+    unsigned iovecs(sys::IoVec* out, unsigned max) const {
+        unsigned n = 0;
+        for (const Slice& s : m_slices) {
+            if (n == max) break;
+            if (s.len > 0) out[n++] = sys::make_iovec(s.data, s.len);
+        }
+        return n;
+    }
+
+private:
+    size_t tail_space() const {
+        if (m_slices.empty()) return 0;
+        const Slice& s = m_slices.back();
+        if (!s.limit || s.storage->refs.load(std::memory_order_relaxed) != 1) return 0;
+        return static_cast<size_t>(s.limit - (s.data + s.len));
+    }
+
+    void push(const Slice& s) {
+        m_slices.push_back(s);
+        m_size += s.len;
+    }
+
+    // New storage with room for at least `min` bytes, from the pool when it fits a block
+    Slice allocate(size_t min) {
+        size_t want = std::max(min + sizeof(Storage), BufferPool::BLOCK_SIZE);
+        if (m_pool && want <= BufferPool::MAX_BLOCK_SIZE) {
+            if (void* mem = m_pool->allocate(want)) {
+                Storage* s = new (mem) Storage(&release_pool, m_pool);
+                char* data = reinterpret_cast<char*>(s + 1);
+                return Slice{ s, data, 0, static_cast<char*>(mem) + BufferPool::block_size(mem) };
+            }
+        }
+        void* mem = ::operator new(want);
+        Storage* s = new (mem) Storage(&release_heap, nullptr);
+        char* data = reinterpret_cast<char*>(s + 1);
+        return Slice{ s, data, 0, static_cast<char*>(mem) + want };
+    }
+
+    static void unref(Storage* s) {
+        if (s && s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) s->release(s);
+    }
+
+    static void release_pool(Storage* s) {
+        BufferPool* pool = s->pool;
+        s->~Storage();
+        pool->deallocate(s);
+    }
+
+    static void release_heap(Storage* s) {
+        s->~Storage();
+        ::operator delete(s);
+    }
+
+    BufferPool* m_pool = nullptr;
+    std::vector<Slice> m_slices;
+    size_t m_size = 0;
+};
+
+}
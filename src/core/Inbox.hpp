@@ -0,0 +1,76 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <utility>
+
+namespace core {
+
+// Intrusive message: embed it and set `run`. It must stay alive until run;
+// one still queued when the inbox goes away is passed to `drop`, if set.
+struct InboxMessage {
+    InboxMessage* next = nullptr;
+    void (*run)(InboxMessage* m) = nullptr;
+    void (*drop)(InboxMessage* m) = nullptr;
+};
+
+// Heap-allocated message around a function; frees itself once run or dropped
+struct FunctionMessage : InboxMessage {
+    std::function<void()> fn;
+
+    explicit FunctionMessage(std::function<void()> f) : fn(std::move(f)) {
+        run = [](InboxMessage* m) {
+            FunctionMessage* self = static_cast<FunctionMessage*>(m);
+            self->fn();
+            delete self;
+        };
+        drop = [](InboxMessage* m) { delete static_cast<FunctionMessage*>(m); };
+    }
+};
+
+// Lock-free multi-producer single-consumer queue. Producers push onto a
+// Treiber stack; the consumer takes the whole stack with one exchange and
+// reverses it, so a drain costs one atomic operation however many messages
+// arrived.
+class Inbox {
+public:
+    Inbox() = default;
+    Inbox(const Inbox&) = delete;
+    Inbox& operator=(const Inbox&) = delete;
+
+    ~Inbox() {
+        InboxMessage* m = m_head.exchange(nullptr, std::memory_order_acquire);
+        while (m) {
+            InboxMessage* next = m->next;
+            if (m->drop) m->drop(m);
+            m = next;
+        }
+    }
+
+    // Any thread
+    void push(InboxMessage* m) {
+        InboxMessage* head = m_head.load(std::memory_order_relaxed);
+        do {
+            m->next = head;
+        } while (!m_head.compare_exchange_weak(head, m, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    bool empty() const { return m_head.load(std::memory_order_relaxed) == nullptr; }
+
+    // Consumer only. Returns everything pushed so far, oldest first.
+    InboxMessage* take_all() {
+        InboxMessage* m = m_head.exchange(nullptr, std::memory_order_acquire);
+        InboxMessage* fifo = nullptr;
+        while (m) {
+            InboxMessage* next = m->next;
+            m->next = fifo;
+            fifo = m;
+            m = next;
+        }
+        return fifo;
+    }
+
+private:
+    std::atomic<InboxMessage*> m_head{ nullptr };
+};
+
+}
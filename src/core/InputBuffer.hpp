@@ -0,0 +1,93 @@
+#pragma once
+#include "BufferPool.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+#include <span>
+
+namespace core {
+
+// Contiguous holding area for bytes a connection received but could not use
+// yet, i.e. the start of a request whose end has not arrived. Lives in a
+// single pool block (heap above BufferPool::MAX_BLOCK_SIZE) that is swapped
+// for a larger one when it fills; the bytes are only moved back to the front
+// when the block has the room but not at the end. An empty buffer holds no
+// block, so idle connections cost nothing.
+class InputBuffer {
+public:
+    explicit InputBuffer(BufferPool& pool, size_t max_size = BufferPool::MAX_BLOCK_SIZE)
+        : m_pool(pool), m_max_size(max_size) {}
+    ~InputBuffer() { release(); }
+
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer& operator=(const InputBuffer&) = delete;
+
+    bool empty() const { return m_begin == m_end; }
+    size_t size() const { return m_end - m_begin; }
+    size_t max_size() const { return m_max_size; }
+    std::span<const char> data() const { return { m_data + m_begin, size() }; }
+
+    // Appends `len` bytes; false (and nothing appended) if that would take the buffer past max_size()
+    bool append(const void* src, size_t len) {
+        if (len > m_max_size - size()) return false;
+        if (m_capacity - m_end < len) make_room(len);
+        memcpy(m_data + m_end, src, len);
+        m_end += len;
+        return true;
+    }
+
+    // Drops `n` bytes from the front; the block goes back to the pool once nothing is left
+    void consume(size_t n) {
+        m_begin += std::min(n, size());
+        if (empty()) release();
+    }
+
+private:
+    void make_room(size_t len) {
+        size_t live = size();
+        size_t need = live + len;
+        if (m_data && need <= m_capacity) {
+            memmove(m_data, m_data + m_begin, live);
+        } else {
+            char* block = nullptr;
+            size_t capacity = 0;
+            bool pooled = false;
+            if (void* mem = m_pool.allocate(std::max(need, BufferPool::BLOCK_SIZE))) {
+                block = static_cast<char*>(mem);
+                capacity = BufferPool::block_size(mem);
+                pooled = true;
+            } else {
+                capacity = std::bit_ceil(need);
+                block = static_cast<char*>(::operator new(capacity));
+            }
+            if (live > 0) memcpy(block, m_data + m_begin, live);
+            release();
+            m_data = block;
+            m_capacity = capacity;
+            m_pooled = pooled;
+        }
+        m_begin = 0;
+        m_end = live;
+    }
+
+    void release() {
+        if (m_data) {
+            if (m_pooled) m_pool.deallocate(m_data);
+            else ::operator delete(m_data);
+        }
+        m_data = nullptr;
+        m_capacity = 0;
+        m_begin = m_end = 0;
+    }
+
+    BufferPool& m_pool;
+    size_t m_max_size;
+    char* m_data = nullptr;
+    size_t m_capacity = 0;
+    size_t m_begin = 0;
+    size_t m_end = 0;
+    bool m_pooled = false;
+};
+
+}
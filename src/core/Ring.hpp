@@ -1,11 +1,66 @@
 #pragma once
 #include "../sys/Platform.hpp"
+#include "TimerWheel.hpp"
+#include "Inbox.hpp"
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <coroutine>
+#include <atomic>
+#include <functional>
 
 namespace core {
 
+class BufferPool;
+
+// Ring setup knobs. Everything except sq_entries is Linux-only and ignored by
+// the IOCP backend.
+struct RingConfig {
+    unsigned sq_entries = 4096;
+    unsigned cq_entries = 0; // 0 = kernel default (2x sq_entries)
+
+    // Kernel-side submission polling: a kernel thread picks up SQEs, so
+    // submitting needs no syscall while it is awake.
+    bool sqpoll = false;
+    unsigned sq_thread_idle_ms = 1000;
+    int sq_thread_cpu = -1; // -1 = let the scheduler decide
+
+    // Thread-per-core modes: only one thread ever submits to this ring, and
+    // task work runs only when that thread asks for completions.
+    bool single_issuer = false;
+    bool defer_taskrun = false; // Implies single_issuer; incompatible with sqpoll
+    bool coop_taskrun = false;  // Incompatible with sqpoll
+
+    bool register_ring_fd = false;
+
+    // Size of the registered file table. When non-zero, accepted connections
+    // go straight into it and are addressed as direct descriptors.
+    unsigned direct_descriptors = 0;
+};
+
+struct RingStats {
+    uint64_t iterations = 0;
+    uint64_t sqes_submitted = 0;
+    uint64_t cqes_reaped = 0;
+    uint64_t syscalls = 0;
+
+    // Submission queue pressure. If these keep growing, raise sq_entries.
+    uint64_t sq_overflows = 0;       // Times the SQ was full and had to be flushed early
+    uint64_t sqes_backlogged = 0;    // Requests parked because flushing didn't free a slot
+    uint64_t backlog_high_water = 0; // Most requests parked at once
+
+    uint64_t messages = 0; // Messages run from the inbox (see Ring::post)
+    uint64_t wakeups = 0;  // Times another thread had to wake this ring
+
+    // Values for the most recent process_completions() call
+    unsigned last_submitted = 0;
+    unsigned last_reaped = 0;
+};
+
 class Ring {
 public:
-    explicit Ring(unsigned entries = 4096);
+    explicit Ring(const RingConfig& config = RingConfig{});
+    explicit Ring(unsigned entries) : Ring(RingConfig{ .sq_entries = entries }) {}
     ~Ring();
 
     Ring(const Ring&) = delete;
@@ -22,23 +77,268 @@ public:
     // Submit a write request
     void submit_write(sys::native_handle_t fd, const void* buf, size_t len, sys::NativeOverlapped* ov);
 
+    // Gathers `count` segments into one socket send, which never raises
+    // SIGPIPE (Linux: sendmsg with MSG_NOSIGNAL, built in `msg`). `iov` and
+    // `msg` must stay valid until completion.
+    void submit_writev(sys::native_handle_t fd, const sys::IoVec* iov, unsigned count, sys::MsgHdr* msg, sys::NativeOverlapped* ov);
+
+    // Zero-copy gathered send (Linux). A successful send posts two completions:
+    // the result with IORING_CQE_F_MORE, then one with IORING_CQE_F_NOTIF once
+    // the kernel no longer references the segments' memory. `iov` and `msg`
+    // must stay valid until the result. Windows has no zero-copy path and
+    // completes it like submit_writev.
+    void submit_sendmsg_zc(sys::native_handle_t fd, const sys::IoVec* iov, unsigned count, sys::MsgHdr* msg, sys::NativeOverlapped* ov);
+
     // Submit an accept request
     void submit_accept(sys::native_handle_t server_fd, void* output_buffer, int* client_len, sys::NativeOverlapped* ov);
 
-    
-    void submit_sendfile(sys::os_fd_t file_fd, sys::native_handle_t socket_fd, size_t offset, size_t count, sys::NativeOverlapped* ov);
+#ifdef PLATFORM_LINUX
+    // One SQE that keeps posting a completion per accepted connection (ov->on_complete
+    // must be set). Re-arm when a completion arrives without IORING_CQE_F_MORE.
+    void submit_accept_multishot(sys::native_handle_t server_fd, sys::NativeOverlapped* ov);
 
-    
+    // Provided buffers: `entries` (power of two) pool blocks are handed to the
+    // kernel, which picks one per recv. Completions carry the buffer id in
+    // their flags. Blocks stay owned by the pool.
+    bool register_buffer_ring(BufferPool& pool, unsigned entries);
+    bool has_buffer_ring() const { return m_buf_ring != nullptr; }
+
+    // Multishot recv selecting from the buffer ring (ov->on_complete must be set)
+    void submit_recv_multishot(sys::native_handle_t fd, sys::NativeOverlapped* ov);
+
+    void* provided_buffer(uint16_t bid) const { return m_buf_addrs[bid]; }
+    // Gives a consumed buffer back to the kernel
+    void recycle_buffer(uint16_t bid);
+    // Keeps the block (caller must return it to the pool) and refills its slot
+    // with a fresh block
+    void* detach_buffer(uint16_t bid);
+    // Refills slots emptied by detach_buffer while the pool was exhausted
+    unsigned replenish_buffers();
+
+    // Registers the pool's slabs so reads/writes into them use READ_FIXED/WRITE_FIXED
+    bool register_buffers(BufferPool& pool);
+
+    // Direct descriptors are tagged so every submit_* knows to set IOSQE_FIXED_FILE
+    static constexpr int DIRECT_FD = 1 << 30;
+    static bool is_direct(sys::native_handle_t fd) { return fd >= 0 && (fd & DIRECT_FD); }
+    bool uses_direct_descriptors() const { return m_files_registered; }
+#endif
+
+    // Cancels the request submitted on `fd` with `target`; it completes with
+    // -ECANCELED (0 bytes on Windows). On Linux the cancel's own result (0,
+    // -ENOENT or -EALREADY) completes on `ov` when one is given; IOCP cancels
+    // synchronously and ignores it.
+    void submit_cancel(sys::native_handle_t fd, sys::NativeOverlapped* target, sys::NativeOverlapped* ov = nullptr);
+
+    // Closes a connection socket, including direct descriptors
+    void close_socket(sys::native_handle_t fd);
+
+    // Sends `count` bytes of a file. On Windows this is TransmitFile and `head`
+    // (e.g. the response headers) goes out in front of the file in the same
+    // call. On Linux it is a splice, so `socket_fd` must be a pipe and `head`
+    // is not supported; serve files from a mapping with submit_writev instead.
+    void submit_sendfile(sys::os_fd_t file_fd, sys::native_handle_t socket_fd, size_t offset, size_t count, sys::NativeOverlapped* ov,
+                         const void* head = nullptr, size_t head_len = 0);
+
+    // On Linux this is a plain recv and `addr` is left untouched; use
+    // submit_recvmsg when the sender's address is needed
     void submit_recvfrom(sys::native_handle_t fd, void* buffer, size_t len, struct sockaddr* addr, int* addr_len, sys::NativeOverlapped* ov);
 
-    
+    // `msg` (and everything it points to) must stay valid until completion
+    void submit_recvmsg(sys::native_handle_t fd, sys::MsgHdr* msg, sys::NativeOverlapped* ov);
+    void submit_sendmsg(sys::native_handle_t fd, const sys::MsgHdr* msg, sys::NativeOverlapped* ov);
+
+    // One loop iteration: flush every queued submission, optionally wait for
+    // at least one completion, then reap and resume everything that is ready.
+    // Returns the number of completions processed.
     int process_completions(bool wait_for_completion = true);
 
+    // Timers run on the ring's thread from process_completions(), with 1 ms
+    // resolution. A Timer must not move while it is scheduled.
+    static uint64_t now_ms() {
+        using namespace std::chrono;
+        return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+    }
+    void add_timer(Timer& t, uint64_t delay_ms) { m_timers.schedule(t, now_ms() + delay_ms); }
+    void cancel_timer(Timer& t) { m_timers.cancel(t); }
+
+    struct SleepAwaitable {
+        Ring& ring;
+        uint64_t ms;
+        Timer timer;
+
+        bool await_ready() const { return ms == 0; }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            timer.user_data = h.address();
+            timer.on_expire = [](Timer* t) { std::coroutine_handle<>::from_address(t->user_data).resume(); };
+            ring.add_timer(timer, ms);
+        }
+
+        void await_resume() {}
+    };
+
+    SleepAwaitable sleep(uint64_t ms) { return SleepAwaitable{ *this, ms, {} }; }
+
+    // Runs `m->run(m)` on this ring's thread during a later process_completions().
+    // Safe from any thread; nothing is allocated, the caller owns `m`. The inbox
+    // is drained in batches, and a ring is woken at most once per batch: with
+    // IORING_OP_MSG_RING when the poster runs its own ring, through an eventfd
+    // otherwise (IOCP: a posted packet).
+    void post(InboxMessage* m) {
+        m_inbox.push(m);
+        if (t_current != this && !m_wake_pending.exchange(true, std::memory_order_acq_rel)) {
+            wake();
+        }
+    }
+
+    // Convenience: runs `fn`, at the cost of allocating a message for it
+    void post(std::function<void()> fn) { post(new FunctionMessage(std::move(fn))); }
+
+    // Resumes `waiter`. Embed one in an awaitable to get back onto a ring
+    // without allocating.
+    struct ResumeMessage : InboxMessage {
+        std::coroutine_handle<> waiter;
+
+        ResumeMessage() {
+            run = [](InboxMessage* m) { static_cast<ResumeMessage*>(m)->waiter.resume(); };
+        }
+    };
+
+    // The ring driven by the calling thread, if any
+    static Ring* current() { return t_current; }
+
+    // `co_await ring.schedule()` continues the coroutine on `ring`'s thread
+    struct ScheduleAwaitable {
+        Ring& ring;
+        ResumeMessage message{};
+
+        bool await_ready() const { return t_current == &ring; }
+        void await_suspend(std::coroutine_handle<> h) {
+            message.waiter = h;
+            ring.post(&message);
+        }
+        void await_resume() {}
+    };
+
+    ScheduleAwaitable schedule() { return ScheduleAwaitable{ *this }; }
+
+    // `co_await ring.call(fn)` runs `fn` on `ring`'s thread, then resumes the
+    // caller back on the ring it came from. Hand results back through captures.
+    template <typename Fn>
+    struct CallAwaitable {
+        Ring& ring;
+        Fn fn;
+
+        bool await_ready() {
+            if (t_current != &ring) return false;
+            fn();
+            return true;
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            Ring* home = t_current;
+            ring.post([this, home, h] {
+                fn();
+                if (home && home != t_current) {
+                    home->post([h] { h.resume(); });
+                } else {
+                    h.resume();
+                }
+            });
+        }
+
+        void await_resume() {}
+    };
+
+    template <typename Fn>
+    CallAwaitable<Fn> call(Fn fn) { return CallAwaitable<Fn>{ *this, std::move(fn) }; }
+
+    const RingStats& stats() const { return m_stats; }
+    const RingConfig& config() const { return m_config; }
+
 private:
+    static constexpr unsigned CQE_BATCH = 256;
+
+    RingConfig m_config;
+    RingStats m_stats;
+    TimerWheel m_timers{ now_ms() };
+
+    static inline thread_local Ring* t_current = nullptr;
+    Inbox m_inbox;
+    std::atomic<bool> m_wake_pending{ false }; // A wakeup is in flight
+
+    void wake();
+
+    void drain_inbox() {
+        m_wake_pending.exchange(false, std::memory_order_acq_rel);
+
+        InboxMessage* m = m_inbox.take_all();
+        while (m) {
+            InboxMessage* next = m->next;
+            m->run(m);
+            m_stats.messages++;
+            m = next;
+        }
+    }
+
+    static void on_wake(sys::NativeOverlapped* ov, int, uint32_t) {
+        Ring* self = static_cast<Ring*>(ov->user_data);
+        self->m_stats.wakeups++;
+        self->drain_inbox();
+    }
+
 #ifdef PLATFORM_LINUX
+    static constexpr int BUFFER_GROUP = 0;
+
     struct io_uring m_ring;
+
+    struct io_uring_buf_ring* m_buf_ring = nullptr;
+    unsigned m_buf_entries = 0;
+    BufferPool* m_buf_pool = nullptr;
+    std::vector<void*> m_buf_addrs; // Indexed by buffer id
+
+    std::unordered_map<uintptr_t, int> m_fixed; // Registered slab base -> buffer index
+    bool m_files_registered = false;
+
+    // A single IORING_OP_TIMEOUT wakes the loop for the earliest timer
+    sys::NativeOverlapped m_timeout_ov;
+    struct __kernel_timespec m_timeout_ts = {};
+    uint64_t m_timeout_at = 0; // Tick the armed timeout fires at, 0 = none armed
+
+    // Wakeups: MSG_RING completions land on m_msg_ov; other threads write the eventfd
+    bool m_msg_ring = false;
+    sys::NativeOverlapped m_msg_ov;
+    // Completes on the sending ring when a MSG_RING aimed at this one fails
+    sys::NativeOverlapped m_msg_failed_ov;
+    int m_eventfd = -1;
+    uint64_t m_eventfd_value = 0;
+    sys::NativeOverlapped m_eventfd_ov;
+
+    void arm_eventfd();
+    void wake_eventfd();
+    static void on_msg_failed(sys::NativeOverlapped* ov, int result, uint32_t flags);
+    static void on_eventfd(sys::NativeOverlapped* ov, int result, uint32_t flags);
+
+    void arm_timeout();
+    static void on_timeout(sys::NativeOverlapped* ov, int result, uint32_t flags);
+    // Requests that found the SQ full, in submission order. Copied into the
+    // SQ at the top of the next process_completions(). A fixed ring of one
+    // SQ's worth, allocated up front so parking a request never allocates.
+    std::vector<struct io_uring_sqe> m_backlog;
+    size_t m_backlog_head = 0;
+    size_t m_backlog_count = 0;
+
+    // Never fails: returns a parked slot when the SQ has no room
+    struct io_uring_sqe* get_sqe();
+    void flush();
+    void drain_backlog();
+
+    int fixed_index(const void* buf, size_t len) const;
+    void prep_target(struct io_uring_sqe* sqe, sys::native_handle_t fd) const;
 #elif defined(PLATFORM_WINDOWS)
     HANDLE m_iocp;
+    sys::NativeOverlapped m_wake_ov = {};
 #endif
 };
 
@@ -1,32 +1,96 @@
 #pragma once
 #include "Ring.hpp"
 #include "BufferPool.hpp"
+#include "InputBuffer.hpp"
 #include "../http/Router.hpp"
 #include "../http/Parser.hpp"
 #include "../http2/Session.hpp"
 #include "../quic/UdpSocket.hpp"
 #include "../quic/QuicSession.hpp"
 #include "../coro/Task.hpp"
+#include "../coro/IOAwaitable.hpp"
+#include "../coro/Cancellation.hpp"
+#include "../coro/Offload.hpp"
+#include "WorkerPool.hpp"
+#include "../coro/AcceptStream.hpp"
+#include "../coro/RecvStream.hpp"
+#include "../coro/SendZc.hpp"
+#include "../coro/Writev.hpp"
 #include "../api/UserController.hpp"
 #include "../tls/TlsContext.hpp"
 #include "../tls/TlsSession.hpp"
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cstring>
+#include <cerrno>
 
 namespace core {
 
+struct ServerConfig {
+    int port = 8080;
+    std::string cert_file;
+    std::string key_file;
+
+    // Number of shards (event loop threads). 0 = one per online CPU.
+    unsigned shards = 0;
+    bool pin_threads = true;
+
+    // With sqpoll and sq_thread_cpu set, shard N pins its SQ thread to sq_thread_cpu + N
+    core::RingConfig ring;
+    size_t pool_blocks = 10000; // Per shard, pre-carved 4 KiB blocks
+    size_t pool_max_bytes = 0;  // Per shard cap on pool growth (0 = unbounded)
+    core::HugePages pool_huge_pages = core::HugePages::Transparent;
+    // Place each shard's pool on the NUMA node of the CPU it is pinned to (needs pin_threads)
+    bool numa_bind = true;
+    // Linux: pool blocks lent to the kernel for multishot recv (power of two, 0 = off)
+    unsigned provided_buffers = 1024;
+    // Linux: register the pool with the ring so I/O into it uses READ_FIXED/WRITE_FIXED.
+    // Opt-in: registration pins the slabs, which counts against RLIMIT_MEMLOCK,
+    // and only covers the slabs that exist at startup.
+    bool fixed_buffers = false;
+
+    // Connections that stay silent this long are closed (milliseconds, 0 = never)
+    uint32_t keepalive_timeout_ms = 60000; // Between requests
+    uint32_t handshake_timeout_ms = 10000; // Whole TLS handshake
+    uint32_t header_timeout_ms = 15000;    // Between reads of a partially received request
+
+    // Largest request head (request line and headers) we buffer; beyond it the client gets 431
+    size_t max_request_bytes = 64 * 1024;
+    // Largest body buffered for a handler; beyond it the client gets 413, unless the route streams
+    size_t max_body_bytes = 1024 * 1024;
+
+    // Responses to pipelined requests are gathered and sent with one write
+    // per read; a batch that grows past this goes out early
+    size_t max_batch_bytes = 256 * 1024;
+
+    // Responses at least this large are sent with zero-copy sendmsg (0 = never).
+    // Each send within them is only zero-copy if it carries this much, too.
+    size_t zero_copy_threshold = 64 * 1024;
+
+    // Worker threads for routes added with Dispatch::Offload (0 = one per
+    // online CPU). The pool is only started if such a route exists.
+    unsigned workers = 0;
+
+    // GET route serving every shard's pool stats as JSON (empty = off). It
+    // shares the public listener, so it is opt-in (e.g. /stats/pools).
+    std::string stats_path;
+};
+
 class Server {
 public:
-    Server(int port = 8080, const std::string& cert_file = "", const std::string& key_file = "") 
-        : m_port(port), m_ring(4096), m_pool(10000) {
-        m_ring.init();
-        
-        if (!cert_file.empty() && !key_file.empty()) {
+    explicit Server(const ServerConfig& config) : m_config(config), m_port(config.port) {
+        if (!config.cert_file.empty() && !config.key_file.empty()) {
             try {
-                m_tls_ctx.init(cert_file, key_file);
+                m_tls_ctx.init(config.cert_file, config.key_file);
                 m_use_tls = true;
-                std::cout << "[Server] TLS Enabled (Port " << port << ")\n";
+                std::cout << "[Server] TLS Enabled (Port " << m_port << ")\n";
             } catch (const std::exception& e) {
                 std::cerr << "[Server] TLS Init Failed: " << e.what() << "\n";
                 exit(1);
@@ -44,7 +108,22 @@ public:
         #ifdef PLATFORM_WINDOWS
         m_file_handle = CreateFileA("index.html", GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, NULL);
         if (m_file_handle != INVALID_HANDLE_VALUE) {
-            GetFileSizeEx(m_file_handle, &m_file_size);
+            LARGE_INTEGER size;
+            GetFileSizeEx(m_file_handle, &size);
+            m_file_size = size.QuadPart;
+            m_file_mapping = CreateFileMappingA(m_file_handle, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (m_file_mapping) {
+                m_file_view = static_cast<const char*>(MapViewOfFile(m_file_mapping, FILE_MAP_READ, 0, 0, 0));
+            }
+        }
+        #else
+        m_file_handle = open("index.html", O_RDONLY);
+        struct stat st;
+        if (m_file_handle >= 0 && fstat(m_file_handle, &st) == 0) {
+            m_file_size = st.st_size;
+            // Responses gather straight from the page cache through this mapping
+            void* view = m_file_size > 0 ? mmap(nullptr, m_file_size, PROT_READ, MAP_SHARED, m_file_handle, 0) : MAP_FAILED;
+            if (view != MAP_FAILED) m_file_view = static_cast<const char*>(view);
         }
         #endif
 
@@ -57,118 +136,419 @@ public:
         });
         
         api::UserController::register_routes(m_router);
+
+        if (!config.stats_path.empty()) {
+            // Inline: a rare request, and pool_stats() is safe from any shard. Offloading
+            // it would start the worker pool for every deployment.
+            m_router.add(http::Method::HTTP_GET, config.stats_path, [this](const http::Request&) {
+                http::Response res;
+                res.content_type = "application/json";
+                res.body = pool_stats_json();
+                return res;
+            });
+        }
+    }
+
+    Server(int port = 8080, const std::string& cert_file = "", const std::string& key_file = "")
+        : Server(make_config(port, cert_file, key_file)) {}
+
+    ~Server() {
+        #ifdef PLATFORM_WINDOWS
+        if (m_file_view) UnmapViewOfFile(m_file_view);
+        if (m_file_mapping) CloseHandle(m_file_mapping);
+        if (m_file_handle != INVALID_HANDLE_VALUE) CloseHandle(m_file_handle);
+        #else
+        if (m_file_view) munmap(const_cast<char*>(m_file_view), m_file_size);
+        if (m_file_handle >= 0) close(m_file_handle);
+        #endif
     }
 
+    // Starts every shard and runs shard 0 on the calling thread. Routes must be
+    // registered before this point: each shard takes its own copy of the router.
     void run() {
-        std::cout << "Server starting on port " << m_port << "...\n";
-        
-        
-        auto tcp_task = accept_loop();
-        auto udp_task = udp_listener();
+        unsigned count = shard_count();
+        std::cout << "Server starting on port " << m_port << " with " << count << " shard(s)...\n";
 
-        std::cout << "Engine Running. Press Ctrl+C to stop.\n";
-        
-        while (true) {
-            m_ring.process_completions(true);
+        {
+            std::lock_guard<std::mutex> guard(m_shards_lock);
+            m_shards.assign(count, nullptr);
         }
+
+        if (m_router.has_offload()) {
+            m_workers = std::make_unique<core::WorkerPool>(m_config.workers);
+            std::cout << "[Server] " << m_workers->size() << " worker thread(s) for offloaded handlers\n";
+        }
+
+        std::vector<std::thread> threads;
+        threads.reserve(count - 1);
+        for (unsigned i = 1; i < count; ++i) {
+            threads.emplace_back([this, i] { run_shard(i); });
+        }
+
+        std::cout << "Engine Running. Press Ctrl+C to stop.\n";
+        run_shard(0);
+
+        for (auto& t : threads) t.join();
+        m_workers.reset();
     }
 
     http::Router& router() { return m_router; }
 
+    // Graceful shutdown: stops accepting, cancels pending receives (so idle
+    // keep-alive connections close right away) and lets responses already
+    // being written finish. run() returns once every shard is done. Callable
+    // from any thread.
+    void stop() {
+        std::lock_guard<std::mutex> guard(m_shards_lock);
+        m_stopping.store(true, std::memory_order_release);
+        for (Shard* shard : m_shards) {
+            if (shard) shard->ring.post([shard] { shard->shutdown.request_cancel(); });
+        }
+    }
+
+    struct ShardPoolStats {
+        unsigned shard;
+        core::BufferPool::Stats pool;
+        coro::FrameStats frames;
+    };
+
+    // Pool and coroutine frame counters of every running shard. Callable from any thread.
+    std::vector<ShardPoolStats> pool_stats() {
+        std::lock_guard<std::mutex> guard(m_shards_lock);
+        std::vector<ShardPoolStats> out;
+        for (Shard* shard : m_shards) {
+            if (shard) out.push_back(ShardPoolStats{ shard->id, shard->pool.stats(), coro::FrameAllocator::stats(shard->frames) });
+        }
+        return out;
+    }
+
+    std::string pool_stats_json() {
+        // Upper bound of each lifetime bucket; the last one is open-ended
+        std::string out = "{\"lifetime_limits_us\": [";
+        for (unsigned b = 0; b + 1 < core::BufferPool::LIFETIME_BUCKETS; ++b) {
+            if (b > 0) out += ", ";
+            out += std::to_string(core::BufferPool::lifetime_limit_us(b));
+        }
+        out += "], \"shards\": [";
+        bool first_shard = true;
+        for (const ShardPoolStats& s : pool_stats()) {
+            if (!first_shard) out += ", ";
+            first_shard = false;
+            out += "{\"shard\": " + std::to_string(s.shard);
+            out += ", \"reserved_bytes\": " + std::to_string(s.pool.reserved_bytes);
+            out += ", \"max_bytes\": " + std::to_string(s.pool.max_bytes);
+            out += ", \"slabs\": " + std::to_string(s.pool.slabs);
+            out += ", \"huge_page_slabs\": " + std::to_string(s.pool.huge_page_slabs);
+            out += ", \"oversize\": " + std::to_string(s.pool.oversize);
+            out += ", \"classes\": [";
+            bool first_class = true;
+            for (const core::BufferPool::ClassStats& c : s.pool.classes) {
+                if (c.blocks == 0 && c.allocations == 0 && c.failures == 0) continue;
+                if (!first_class) out += ", ";
+                first_class = false;
+                out += "{\"block_size\": " + std::to_string(c.block_size);
+                out += ", \"blocks\": " + std::to_string(c.blocks);
+                out += ", \"allocations\": " + std::to_string(c.allocations);
+                out += ", \"frees\": " + std::to_string(c.frees);
+                out += ", \"failures\": " + std::to_string(c.failures);
+                out += ", \"in_use\": " + std::to_string(c.in_use);
+                out += ", \"high_water\": " + std::to_string(c.high_water);
+                out += ", \"lifetime_us\": [";
+                for (unsigned b = 0; b < core::BufferPool::LIFETIME_BUCKETS; ++b) {
+                    if (b > 0) out += ", ";
+                    out += std::to_string(c.lifetimes[b]);
+                }
+                out += "]}";
+            }
+            out += "], \"frames\": {\"oversize\": " + std::to_string(s.frames.oversize);
+            out += ", \"remote_frees\": " + std::to_string(s.frames.remote_frees);
+            out += ", \"largest\": " + std::to_string(s.frames.largest);
+            out += ", \"buckets\": [";
+            bool first_bucket = true;
+            for (const coro::FrameStats::Bucket& b : s.frames.buckets) {
+                if (b.allocations == 0) continue;
+                if (!first_bucket) out += ", ";
+                first_bucket = false;
+                out += "{\"frame_size\": " + std::to_string(b.frame_size);
+                out += ", \"allocations\": " + std::to_string(b.allocations);
+                out += ", \"fresh\": " + std::to_string(b.fresh);
+                out += ", \"live\": " + std::to_string(b.live);
+                out += ", \"high_water\": " + std::to_string(b.high_water);
+                out += ", \"cached\": " + std::to_string(b.cached) + "}";
+            }
+            out += "]}}";
+        }
+        out += "]}";
+        return out;
+    }
+
 private:
+    static ServerConfig make_config(int port, const std::string& cert_file, const std::string& key_file) {
+        ServerConfig config;
+        config.port = port;
+        config.cert_file = cert_file;
+        config.key_file = key_file;
+        return config;
+    }
+
+    // Everything a shard touches on the hot path. A shard is created on, and
+    // only ever used from, its own thread.
+    struct Shard {
+        unsigned id;
+        core::Ring ring;
+        core::BufferPool pool;
+        http::Router router;
+        sys::native_handle_t listen_fd = sys::INVALID_HANDLE_VALUE_NET;
+        const coro::FrameAllocator::Cache* frames = coro::FrameAllocator::current(); // The shard thread's coroutine frames
+
+        // Cancelled by Server::stop(); accepts and receives watch its tokens.
+        // The shard's loop ends once it is cancelled and no task is left.
+        coro::CancellationSource shutdown;
+        unsigned tasks = 0;
+
+        struct TaskScope {
+            Shard& shard;
+            explicit TaskScope(Shard& s) : shard(s) { shard.tasks++; }
+            ~TaskScope() { shard.tasks--; }
+        };
+
+        Shard(unsigned shard_id, const ServerConfig& config, const http::Router& routes)
+            : id(shard_id), ring(ring_config(shard_id, config.ring)), pool(config.pool_blocks, pool_options(shard_id, config)), router(routes) {
+            ring.init();
+            #ifdef PLATFORM_LINUX
+            if (config.fixed_buffers) {
+                ring.register_buffers(pool);
+            }
+            if (config.provided_buffers > 0) {
+                ring.register_buffer_ring(pool, config.provided_buffers);
+            }
+            #endif
+        }
+
+        static core::RingConfig ring_config(unsigned shard_id, core::RingConfig config) {
+            if (config.sqpoll && config.sq_thread_cpu >= 0) {
+                unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+                config.sq_thread_cpu = (config.sq_thread_cpu + shard_id) % cpus;
+            }
+            return config;
+        }
+
+        static core::BufferPoolOptions pool_options(unsigned shard_id, const ServerConfig& config) {
+            core::BufferPoolOptions options;
+            options.max_bytes = config.pool_max_bytes;
+            options.huge_pages = config.pool_huge_pages;
+            if (config.pin_threads && config.numa_bind) {
+                unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+                options.numa_node = sys::numa_node_of_cpu(shard_id % cpus);
+            }
+            return options;
+        }
+
+        ~Shard() {
+            if (listen_fd != sys::INVALID_HANDLE_VALUE_NET) sys::close_socket(listen_fd);
+        }
+    };
+
+    ServerConfig m_config;
     int m_port;
-    core::Ring m_ring;
-    core::BufferPool m_pool;
     http::Router m_router;
     tls::TlsContext m_tls_ctx;
     bool m_use_tls = false;
+
+    std::mutex m_shards_lock;
+    std::vector<Shard*> m_shards; // Indexed by shard id, null until it is running
+    std::atomic<bool> m_stopping{ false };
+    std::unique_ptr<core::WorkerPool> m_workers; // Runs Dispatch::Offload handlers
     
     #ifdef PLATFORM_WINDOWS
     HANDLE m_file_handle = INVALID_HANDLE_VALUE;
-    LARGE_INTEGER m_file_size;
+    HANDLE m_file_mapping = NULL;
+    #else
+    int m_file_handle = -1;
     #endif
+    uint64_t m_file_size = 0;
+    const char* m_file_view = nullptr; // Read-only mapping of the whole file
 
-    
-    coro::IOAwaitable async_read(sys::native_handle_t fd, void* buf, size_t len, sys::NativeOverlapped* ov) {
-        return coro::IOAwaitable(m_ring, fd, buf, len, ov);
+    void register_shard(unsigned id, Shard* shard) {
+        std::lock_guard<std::mutex> guard(m_shards_lock);
+        if (id < m_shards.size()) m_shards[id] = shard;
     }
 
-    coro::IOAwaitable async_write(sys::native_handle_t fd, const void* buf, size_t len, sys::NativeOverlapped* ov) {
-        coro::IOAwaitable awaitable(m_ring, fd, (void*)buf, len, ov);
-        awaitable.op_type = 1;
-        return awaitable;
+    unsigned shard_count() const {
+        unsigned count = m_config.shards;
+        if (count == 0) count = std::max(1u, std::thread::hardware_concurrency());
+        #ifdef PLATFORM_WINDOWS
+        // No SO_REUSEPORT, and a socket can only be bound to one completion port.
+        if (count > 1) {
+            std::cout << "[Server] Sharding is not available on Windows, using 1 shard\n";
+            count = 1;
+        }
+        #endif
+        return count;
     }
 
-    coro::IOAwaitable async_accept(sys::native_handle_t server_fd, void* buf, struct sockaddr* addr, int* addr_len, sys::NativeOverlapped* ov) {
-        coro::IOAwaitable awaitable(m_ring, server_fd, buf, 0, ov);
-        awaitable.op_type = 2;
-        awaitable.client_addr = addr;
-        awaitable.client_len = addr_len;
-        return awaitable;
-    }
+    void run_shard(unsigned id) {
+        try {
+            if (m_config.pin_threads) {
+                unsigned cpus = std::max(1u, std::thread::hardware_concurrency());
+                if (!sys::pin_current_thread(id % cpus)) {
+                    std::cerr << "[Server] Shard " << id << ": failed to pin to CPU " << (id % cpus) << "\n";
+                }
+            }
 
-    coro::IOAwaitable async_sendfile(sys::native_handle_t socket_fd, sys::os_fd_t file_fd, size_t offset, size_t count, sys::NativeOverlapped* ov) {
-        coro::IOAwaitable awaitable(m_ring, socket_fd, nullptr, count, ov);
-        awaitable.op_type = 3;
-        awaitable.file_fd = file_fd;
-        awaitable.offset = offset;
-        return awaitable;
-    }
+            Shard shard(id, m_config, m_router);
+            register_shard(id, &shard);
+            struct Unregister {
+                Server* server;
+                unsigned id;
+                ~Unregister() { server->register_shard(id, nullptr); }
+            } unregister{ this, id };
+            if (m_stopping.load(std::memory_order_acquire)) shard.shutdown.request_cancel();
+            shard.listen_fd = open_listener();
+            shard.ring.attach(shard.listen_fd);
+            #ifdef PLATFORM_LINUX
+            if (shard.ring.uses_direct_descriptors()) {
+                // Direct descriptors can't take setsockopt; accepted sockets inherit it from the listener
+                int yes = 1;
+                setsockopt(shard.listen_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            }
+            #endif
+
+            coro::spawn(accept_loop(shard));
+            if (id == 0) {
+                coro::spawn(udp_listener(shard));
+            }
 
-    coro::IOAwaitable async_recvfrom(sys::native_handle_t fd, void* buf, size_t len, struct sockaddr* addr, int* addr_len, sys::NativeOverlapped* ov) {
-        coro::IOAwaitable awaitable(m_ring, fd, buf, len, ov);
-        awaitable.op_type = 4;
-        awaitable.client_addr = addr;
-        awaitable.client_len = addr_len;
-        return awaitable;
+            while (!shard.shutdown.cancelled() || shard.tasks > 0) {
+                shard.ring.process_completions(true);
+            }
+            std::cout << "[Server] Shard " << id << " stopped\n";
+        } catch (const std::exception& e) {
+            std::cerr << "[Server] Shard " << id << " failed: " << e.what() << "\n";
+        }
     }
 
-   
-    coro::Task accept_loop() {
+    // Every shard binds its own listening socket to the same port; the kernel
+    // spreads incoming connections across them.
+    sys::native_handle_t open_listener() {
         sys::native_handle_t server_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-        if (server_fd == INVALID_SOCKET) throw std::runtime_error("Socket failed");
+        if (server_fd == sys::INVALID_HANDLE_VALUE_NET) throw std::runtime_error("Socket failed");
+
+        int yes = 1;
+        setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, (const char*)&yes, sizeof(yes));
+        #ifdef PLATFORM_LINUX
+        if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) != 0) {
+            sys::close_socket(server_fd);
+            throw std::runtime_error("SO_REUSEPORT failed");
+        }
+        #endif
 
         sockaddr_in addr;
         addr.sin_family = AF_INET;
         addr.sin_addr.s_addr = INADDR_ANY;
         addr.sin_port = htons(m_port);
 
-        if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) throw std::runtime_error("Bind failed");
-        if (listen(server_fd, SOMAXCONN) == SOCKET_ERROR) throw std::runtime_error("Listen failed");
+        if (bind(server_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server_fd, SOMAXCONN) != 0) {
+            sys::close_socket(server_fd);
+            throw std::runtime_error("Bind/Listen failed");
+        }
+        return server_fd;
+    }
+
+    
+    coro::ReadAwaitable async_read(core::Ring& ring, sys::native_handle_t fd, void* buf, size_t len) {
+        return coro::ReadAwaitable(ring, fd, buf, len);
+    }
+
+    coro::WriteAwaitable async_write(core::Ring& ring, sys::native_handle_t fd, const void* buf, size_t len) {
+        return coro::WriteAwaitable(ring, fd, buf, len);
+    }
+
+    // Writes the whole chain, consuming it
+    coro::ChainWriteAwaitable async_write(core::Ring& ring, sys::native_handle_t fd, core::IOBuf& chain) {
+        return coro::ChainWriteAwaitable(ring, fd, chain);
+    }
+
+    // Takes ownership of `chain` until the kernel is done with it
+    coro::SendZcAwaitable async_send_zc(core::Ring& ring, sys::native_handle_t fd, core::IOBuf chain) {
+        return coro::SendZcAwaitable(ring, fd, std::move(chain), m_config.zero_copy_threshold);
+    }
+
+    bool use_zero_copy(size_t len) const {
+        return m_config.zero_copy_threshold > 0 && len >= m_config.zero_copy_threshold;
+    }
+
+    // All segments are written before it resumes; each must stay alive until then
+    template <typename... Segments>
+    coro::WritevAwaitable async_writev(core::Ring& ring, sys::native_handle_t fd, const Segments&... segments) {
+        return coro::WritevAwaitable(ring, fd, segments...);
+    }
+
+    coro::AcceptAwaitable async_accept(core::Ring& ring, sys::native_handle_t server_fd) {
+        return coro::AcceptAwaitable(ring, server_fd);
+    }
+
+    coro::SendfileAwaitable async_sendfile(core::Ring& ring, sys::native_handle_t socket_fd, sys::os_fd_t file_fd, size_t offset, size_t count,
+                                           const void* head = nullptr, size_t head_len = 0) {
+        return coro::SendfileAwaitable(ring, socket_fd, file_fd, offset, count, head, head_len);
+    }
+
+    coro::RecvFromAwaitable async_recvfrom(core::Ring& ring, sys::native_handle_t fd, void* buf, size_t len) {
+        return coro::RecvFromAwaitable(ring, fd, buf, len);
+    }
+
+   
+    coro::Task<> accept_loop(Shard& shard) {
+        Shard::TaskScope scope(shard);
+        sys::native_handle_t server_fd = shard.listen_fd;
+        coro::CancellationToken stop = shard.shutdown.token();
 
-        m_ring.attach(server_fd);
+        #ifdef PLATFORM_LINUX
+        coro::AcceptStream accepts(shard.ring, server_fd);
 
         while (true) {
-            sockaddr_in client_addr;
-            int client_len = sizeof(client_addr);
-            sys::NativeOverlapped ov;
-            ov.user_data = nullptr;
-            
-            char accept_buffer[1024];
-            co_await async_accept(server_fd, accept_buffer, (sockaddr*)&client_addr, &client_len, &ov);
+            int client_fd = co_await accepts.next(stop);
+            if (client_fd == -ECANCELED && stop.cancelled()) break;
+            if (client_fd < 0) {
+                if (client_fd != -EAGAIN && client_fd != -EINTR) {
+                    std::cerr << "[Server] Accept failed: " << strerror(-client_fd) << "\n";
+                }
+                continue;
+            }
 
-            #ifdef PLATFORM_WINDOWS
-            sys::native_handle_t client_fd = ov.client_socket;
+            if (!core::Ring::is_direct(client_fd)) {
+                int yes = 1;
+                setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            }
+
+            coro::spawn(handle_client(shard, client_fd));
+        }
+        #else
+        while (true) {
+            coro::AcceptResult accepted = co_await async_accept(shard.ring, server_fd).cancel_on(stop);
+            if (accepted.error == -ECANCELED) break;
+
+            sys::native_handle_t client_fd = accepted.fd;
             if (client_fd != sys::INVALID_HANDLE_VALUE_NET) {
                 int yes = 1;
-                setsockopt((SOCKET)client_fd, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char*)&server_fd, sizeof(server_fd));
                 setsockopt((SOCKET)client_fd, IPPROTO_TCP, TCP_NODELAY, (char*)&yes, sizeof(yes));
                 
-                m_ring.attach(client_fd);
-                handle_client(client_fd);
+                shard.ring.attach(client_fd);
+                coro::spawn(handle_client(shard, client_fd));
             }
-            #endif
         }
+        #endif
     }
 
-    coro::Task handle_client(sys::native_handle_t client_fd) {
+    coro::Task<> handle_client(Shard& shard, sys::native_handle_t client_fd) {
+        Shard::TaskScope scope(shard);
+        coro::CancellationToken stop = shard.shutdown.token();
         std::cout << "[Server] Client Connected: " << (uint64_t)client_fd << "\n";
-        void* buffer = m_pool.allocate();
-        sys::NativeOverlapped ov;
+        coro::RecvStream recv(shard.ring, shard.pool, client_fd);
         
         bool is_h2 = false;
-        http2::Session h2_session;
-        http::Parser parser;
+        http2::Session h2_session(shard.pool);
+        Http1Connection http1(shard.pool, m_config);
         
         tls::TlsSession tls_session;
         if (m_use_tls) {
@@ -176,227 +556,47 @@ private:
         }
 
         try {
-           
             if (m_use_tls) {
-                std::cout << "[Server] Starting TLS Handshake...\n";
-                while (true) {
-                    int ret = tls_session.do_handshake();
-                   
-                    std::vector<char> out;
-                    tls_session.extract_encrypted_data(out);
-                    if (!out.empty()) {
-                         
-                         const char* ptr = out.data();
-                         size_t rem = out.size();
-                         while (rem > 0) {
-                             memset(&ov, 0, sizeof(ov));
-                             int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                             if (sent <= 0) throw std::runtime_error("Handshake write failed");
-                             ptr += sent;
-                             rem -= sent;
-                         }
-                    }
-
-                    if (ret == 0) {
-                        std::cout << "[Server] TLS Handshake Complete\n";
-                        break; 
-                    }
-                    if (ret == 1) { 
-                         memset(&ov, 0, sizeof(ov));
-                         int n = co_await async_read(client_fd, buffer, core::BufferPool::BLOCK_SIZE, &ov);
-                         
-                         if (n <= 0) throw std::runtime_error("Handshake read failed");
-                         tls_session.feed_encrypted_data(buffer, n);
-                    } else if (ret == 2) { 
-                       
-                    } else {
-                        throw std::runtime_error("Handshake error");
-                    }
-                }
-
+                co_await tls_handshake(shard, client_fd, recv, tls_session, stop);
             }
             
             while (true) {
-                memset(&ov, 0, sizeof(ov));
-                int bytes_read = co_await async_read(client_fd, buffer, core::BufferPool::BLOCK_SIZE, &ov);
-                if (bytes_read <= 0) break;
+                // An idle connection gets the keep-alive timeout, one in the middle of a request the header timeout
+                bool idle = is_h2 || http1.idle();
+                uint64_t timeout = idle ? m_config.keepalive_timeout_ms : m_config.header_timeout_ms;
 
-                std::vector<char> decrypted_data;
-                const char* parse_ptr = (const char*)buffer;
-                size_t parse_len = bytes_read;
+                // Released back to the pool/buffer ring at the end of this iteration
+                auto in = co_await recv.next(timeout, stop);
+                int bytes_read = in.result();
+                if (bytes_read <= 0) break;
 
+                // Plaintext is borrowed straight from the receive buffer; TLS
+                // decrypts into pool blocks
+                core::IOBuf input(shard.pool);
                 if (m_use_tls) {
-                    if (tls_session.decrypt(buffer, bytes_read, decrypted_data) < 0) {
+                    if (tls_session.decrypt(in.data(), bytes_read, input) < 0) {
                         std::cerr << "[Server] TLS Decrypt Failed\n";
                         break;
                     }
-                    parse_ptr = decrypted_data.data();
-                    parse_len = decrypted_data.size();
-                    if (parse_len == 0) continue; 
+                    if (input.empty()) continue; 
+                } else {
+                    input = core::IOBuf::wrap(in.data(), bytes_read);
                 }
 
-              
-                if (!is_h2 && parse_len >= 24 && memcmp(parse_ptr, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", 24) == 0) {
+                static constexpr char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+                char peek[sizeof(preface) - 1];
+                if (!is_h2 && input.copy_to(peek, sizeof(peek)) == sizeof(peek) && memcmp(peek, preface, sizeof(peek)) == 0) {
                     is_h2 = true;
                     h2_session.send_settings(); // Send server SETTINGS immediately
                 }
 
+                bool keep_open = true;
                 if (is_h2) {
-                    if (!h2_session.on_data((const uint8_t*)parse_ptr, parse_len)) break;
-                    
-                   
-                    std::vector<char> h2_out;
-                    h2_session.consume_output(h2_out);
-                    
-                    if (!h2_out.empty()) {
-                        if (m_use_tls) {
-                            std::vector<char> encrypted;
-                            tls_session.encrypt(h2_out.data(), h2_out.size(), encrypted);
-                            const char* ptr = encrypted.data();
-                            size_t rem = encrypted.size();
-                            while (rem > 0) {
-                                memset(&ov, 0, sizeof(ov));
-                                int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                if (sent <= 0) break;
-                                ptr += sent;
-                                rem -= sent;
-                            }
-                        } else {
-                           
-                            const char* ptr = h2_out.data();
-                            size_t rem = h2_out.size();
-                            while (rem > 0) {
-                                memset(&ov, 0, sizeof(ov));
-                                int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                if (sent <= 0) break;
-                                ptr += sent;
-                                rem -= sent;
-                            }
-                        }
-                    }
-                    continue;
-                }
-
-               
-                if (parser.parse(parse_ptr, parse_len) && parser.state() == http::Parser::State::COMPLETE) {
-                    const auto& req = parser.request();
-                    
-                    http::Response res;
-                    if (m_router.handle(req, res)) {
-                        std::string s = res.to_string();
-                        
-                        if (m_use_tls) {
-                            std::vector<char> encrypted;
-                            tls_session.encrypt(s.data(), s.size(), encrypted);
-                            const char* ptr = encrypted.data();
-                            size_t rem = encrypted.size();
-                            while (rem > 0) {
-                                memset(&ov, 0, sizeof(ov));
-                                int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                if (sent <= 0) break;
-                                ptr += sent;
-                                rem -= sent;
-                            }
-                        } else {
-                            const char* ptr = s.c_str();
-                            size_t rem = s.size();
-                            while (rem > 0) {
-                                memset(&ov, 0, sizeof(ov));
-                                int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                if (sent <= 0) break;
-                                ptr += sent;
-                                rem -= sent;
-                            }
-                        }
-                    }
-                    else if (req.method == http::Method::HTTP_GET && (req.uri == "/" || req.uri == "/index.html")) {
-                        
-                         
-                         if (m_use_tls) {
-                             
-                             std::vector<char> file_buf(m_file_size.QuadPart);
-                             DWORD read;
-                             OVERLAPPED file_ov = {0};
-                             file_ov.Offset = 0;
-                            
-                             
-                            
-                             char header[256];
-                             int header_len = snprintf(header, sizeof(header), 
-                                 "HTTP/1.1 200 OK\r\n"
-                                 "Content-Type: text/html\r\n"
-                                 "Connection: keep-alive\r\n"
-                                 "Content-Length: %lld\r\n"
-                                 "\r\n", 
-                                 m_file_size.QuadPart
-                             );
-                             
-                             std::vector<char> response_data;
-                             response_data.insert(response_data.end(), header, header + header_len);
-                             
-                            
-                             std::vector<char> encrypted;
-                             tls_session.encrypt(response_data.data(), response_data.size(), encrypted);
-                             
-                             const char* ptr = encrypted.data();
-                             size_t rem = encrypted.size();
-                             while (rem > 0) {
-                                 memset(&ov, 0, sizeof(ov));
-                                 int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                 if (sent <= 0) break;
-                                 ptr += sent;
-                                 rem -= sent;
-                             }
-                         } else {
-                            
-                             char header[256];
-                             int header_len = snprintf(header, sizeof(header), 
-                                 "HTTP/1.1 200 OK\r\n"
-                                 "Content-Type: text/html\r\n"
-                                 "Connection: keep-alive\r\n"
-                                 "Content-Length: %lld\r\n"
-                                 "\r\n", 
-                                 m_file_size.QuadPart
-                             );
-
-                             const char* ptr = header;
-                             size_t rem = header_len;
-                             while (rem > 0) {
-                                memset(&ov, 0, sizeof(ov));
-                                int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                if (sent <= 0) break;
-                                ptr += sent;
-                                rem -= sent;
-                             }
-                             
-                             #ifdef PLATFORM_WINDOWS
-                             if (m_file_handle != INVALID_HANDLE_VALUE) {
-                                 memset(&ov, 0, sizeof(ov));
-                                 co_await async_sendfile(client_fd, m_file_handle, 0, m_file_size.QuadPart, &ov);
-                             }
-                             #endif
-                         }
-                    } else {
-                        const char* resp = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
-                        if (m_use_tls) {
-                            std::vector<char> encrypted;
-                            tls_session.encrypt(resp, strlen(resp), encrypted);
-                            const char* ptr = encrypted.data();
-                            size_t rem = encrypted.size();
-                            while (rem > 0) {
-                                memset(&ov, 0, sizeof(ov));
-                                int sent = co_await async_write(client_fd, ptr, rem, &ov);
-                                if (sent <= 0) break;
-                                ptr += sent;
-                                rem -= sent;
-                            }
-                        } else {
-                            co_await async_write(client_fd, resp, strlen(resp), &ov);
-                        }
-                        break; 
-                    }
-                    parser.reset();
+                    keep_open = co_await serve_h2(shard, client_fd, tls_session, h2_session, std::move(input));
+                } else {
+                    keep_open = co_await serve_http1_input(shard, client_fd, tls_session, http1, input);
                 }
+                if (!keep_open) break;
             }
         } catch (const std::exception& e) {
             std::cerr << "[Server] Client Error: " << e.what() << "\n";
@@ -404,30 +604,281 @@ private:
             std::cerr << "[Server] Unknown Client Error\n";
         }
         
-        m_pool.deallocate(buffer);
-        closesocket((SOCKET)client_fd);
-        co_return;
+        co_await recv.stop();
+        shard.ring.close_socket(client_fd);
     }
 
-    coro::Task udp_listener() {
+    // Throws if the handshake fails or outlives handshake_timeout_ms
+    coro::Task<> tls_handshake(Shard& shard, sys::native_handle_t fd, coro::RecvStream& recv, tls::TlsSession& tls, const coro::CancellationToken& stop) {
+        std::cout << "[Server] Starting TLS Handshake...\n";
+        uint64_t deadline = core::Ring::now_ms() + m_config.handshake_timeout_ms;
+        while (true) {
+            int ret = tls.do_handshake();
+
+            core::IOBuf out(shard.pool);
+            tls.extract_encrypted_data(out);
+            if (co_await write_all(shard, fd, std::move(out)) < 0) throw std::runtime_error("Handshake write failed");
+
+            if (ret == 0) {
+                std::cout << "[Server] TLS Handshake Complete\n";
+                co_return;
+            }
+            if (ret == 1) {
+                uint64_t timeout = 0;
+                if (m_config.handshake_timeout_ms > 0) {
+                    uint64_t now = core::Ring::now_ms();
+                    if (now >= deadline) throw std::runtime_error("Handshake timed out");
+                    timeout = deadline - now;
+                }
+                auto in = co_await recv.next(timeout, stop);
+                if (in.result() <= 0) throw std::runtime_error("Handshake read failed");
+                tls.feed_encrypted_data(in.data(), in.result());
+            } else if (ret != 2) {
+                throw std::runtime_error("Handshake error");
+            }
+        }
+    }
+
+    // Feeds one read to the HTTP/2 session and sends whatever it produced
+    coro::Task<bool> serve_h2(Shard& shard, sys::native_handle_t fd, tls::TlsSession& tls, http2::Session& session, core::IOBuf input) {
+        if (!session.on_data(std::move(input))) co_return false;
+        core::IOBuf out(shard.pool);
+        session.consume_output(out);
+        co_return co_await send_output(shard, fd, tls, std::move(out)) >= 0;
+    }
+
+    // HTTP/1.1 state that outlives a single read
+    struct Http1Connection {
+        http::Parser parser;
+        core::InputBuffer pending;            // Start of a request whose end has not arrived yet
+        bool buffering = false;               // Collecting the body for Request::body
+        std::unique_ptr<http::BodySink> sink; // Streaming the body to a route instead
+
+        Http1Connection(core::BufferPool& pool, const ServerConfig& config)
+            : pending(pool, config.max_request_bytes + config.max_body_bytes) {}
+
+        // Between requests rather than in the middle of one
+        bool idle() const { return parser.state() == http::Parser::State::METHOD_START; }
+    };
+
+    // Parses what `input` adds to the connection and answers every request
+    // that is now complete, in order. Requests are parsed where they landed in
+    // the read buffer; only an unfinished one is copied into `pending` to wait
+    // for the rest of it. Streamed bodies are handed over as they arrive and
+    // never kept. The responses are gathered in one chain and sent together,
+    // so a pipelined burst costs one write. Returns false if the connection
+    // should close.
+    coro::Task<bool> serve_http1_input(Shard& shard, sys::native_handle_t fd, tls::TlsSession& tls, Http1Connection& conn, core::IOBuf& input) {
+        http::Parser& parser = conn.parser;
+        core::InputBuffer& pending = conn.pending;
+        auto too_large = [&parser] {
+            return parser.state() == http::Parser::State::BODY ? "413 Content Too Large" : "431 Request Header Fields Too Large";
+        };
+
+        core::IOBuf out(shard.pool);
+        bool keep_open = true;
+
+        bool borrowed = pending.empty() && input.slice_count() == 1;
+        std::span<const char> bytes;
+        if (borrowed) {
+            bytes = input.slice(0);
+        } else {
+            for (size_t i = 0; i < input.slice_count() && keep_open; ++i) {
+                std::span<const char> s = input.slice(i);
+                if (!pending.append(s.data(), s.size())) keep_open = reject(out, too_large());
+            }
+            bytes = pending.data();
+        }
+        auto advance = [&](size_t n) {
+            bytes = bytes.subspan(n);
+            if (!borrowed) pending.consume(n);
+        };
+
+        while (keep_open && !bytes.empty()) {
+            if (conn.sink) {
+                std::string_view piece;
+                size_t used = parser.read_body(bytes.data(), bytes.size(), piece);
+                if (parser.state() == http::Parser::State::PARSE_ERROR) {
+                    keep_open = reject(out, "400 Bad Request");
+                    break;
+                }
+                if (!piece.empty()) conn.sink->write(piece);
+                advance(used);
+                if (parser.state() != http::Parser::State::COMPLETE) continue;
+
+                http::Response res = conn.sink->finish();
+                conn.sink.reset();
+                parser.reset();
+                append_response(out, std::move(res));
+            } else {
+                if (!parser.parse(bytes.data(), bytes.size())) {
+                    keep_open = reject(out, "400 Bad Request");
+                    break;
+                }
+
+                if (parser.state() == http::Parser::State::BODY && !conn.buffering) {
+                    // The head is in; the route decides where the body goes
+                    const http::Request& req = parser.request();
+                    const http::Route* route = shard.router.find(req);
+                    bool body_arrived = bytes.size() > parser.consumed();
+                    if (route && route->stream) {
+                        conn.sink = route->stream(req);
+                        advance(parser.consumed());
+                    } else if (!parser.chunked() && parser.content_length() > m_config.max_body_bytes) {
+                        keep_open = reject(out, "413 Content Too Large");
+                        break;
+                    } else {
+                        conn.buffering = true;
+                    }
+                    // Goes out with this read's batch, which ends once the bytes run out
+                    if (parser.expects_continue() && !body_arrived) out.append(std::string_view("HTTP/1.1 100 Continue\r\n\r\n"));
+                    continue;
+                }
+
+                if (parser.state() != http::Parser::State::COMPLETE) {
+                    if (!conn.buffering && bytes.size() > m_config.max_request_bytes) keep_open = reject(out, too_large());
+                    break;
+                }
+
+                size_t used = parser.consumed();
+                keep_open = co_await serve_http1(shard, fd, tls, parser.request(), out);
+                parser.reset();
+                conn.buffering = false;
+                advance(used);
+            }
+
+            // Bound what a long pipeline holds back
+            if (out.size() >= m_config.max_batch_bytes && !co_await flush(shard, fd, tls, out)) co_return false;
+        }
+
+        // The start of the next request: keep it past this read's buffer
+        if (keep_open && borrowed && !bytes.empty() && !pending.append(bytes.data(), bytes.size())) {
+            keep_open = reject(out, too_large());
+        }
+        if (!co_await flush(shard, fd, tls, out)) co_return false;
+        co_return keep_open;
+    }
+
+    // Answers a request we won't serve; returns false so the caller closes
+    // once the batch is out
+    static bool reject(core::IOBuf& out, std::string_view status) {
+        out.append(std::string_view("HTTP/1.1 "));
+        out.append(status);
+        out.append(std::string_view("\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+        return false;
+    }
+
+    // Answers one complete request by adding the response to `out`. Returns
+    // false if the connection should close.
+    coro::Task<bool> serve_http1(Shard& shard, sys::native_handle_t fd, tls::TlsSession& tls, const http::Request& req, core::IOBuf& out) {
+        if (const http::Route* route = shard.router.find(req)) {
+            http::Response res;
+            if (route->dispatch == http::Dispatch::Offload && m_workers) {
+                // `req` points into this connection's input, which outlives the co_await
+                res = co_await coro::offload(*m_workers, [route, &req] { return http::Router::run(*route, req); });
+            } else {
+                res = http::Router::run(*route, req);
+            }
+            append_response(out, std::move(res));
+            co_return true;
+        }
+
+        if (req.method == http::Method::HTTP_GET && (req.uri == "/" || req.uri == "/index.html")) {
+            char header[256];
+            int header_len = snprintf(header, sizeof(header),
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/html\r\n"
+                "Connection: keep-alive\r\n"
+                "Content-Length: %lld\r\n"
+                "\r\n",
+                (long long)m_file_size
+            );
+
+            #ifdef PLATFORM_WINDOWS
+            if (!m_use_tls && m_file_handle != INVALID_HANDLE_VALUE) {
+                // Headers ride along in the TransmitFile call, after the responses ahead of it
+                if (!co_await flush(shard, fd, tls, out)) co_return false;
+                co_await async_sendfile(shard.ring, fd, m_file_handle, 0, m_file_size, header, header_len);
+                co_return true;
+            }
+            #else
+            (void)fd;
+            (void)tls;
+            #endif
+            out.append(header, header_len);
+            // The mapping lives as long as the server, so the chain can just point at it
+            if (m_file_view) out.append(core::IOBuf::wrap(m_file_view, m_file_size));
+            co_return true;
+        }
+
+        out.append(std::string_view("HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"));
+        co_return false;
+    }
+
+    // Adds a handler's response to `out`. The head goes straight into the
+    // chain's tail when it fits there.
+    static void append_response(core::IOBuf& out, http::Response res) {
+        std::span<char> space = out.tail(1);
+        size_t head_len = res.write_head(space.data(), space.size());
+        if (head_len > 0) {
+            out.commit(head_len);
+        } else {
+            char head[512];
+            head_len = res.write_head(head, sizeof(head));
+            if (head_len > 0) {
+                out.append(head, head_len);
+            } else {
+                out.append(res.head());
+            }
+        }
+        out.adopt(std::move(res.body));
+    }
+
+    // Sends what `out` has gathered and leaves it empty. Returns false if the write failed.
+    coro::Task<bool> flush(Shard& shard, sys::native_handle_t fd, tls::TlsSession& tls, core::IOBuf& out) {
+        if (out.empty()) co_return true;
+        co_return co_await send_output(shard, fd, tls, std::exchange(out, core::IOBuf(shard.pool))) >= 0;
+    }
+
+    // Encrypts `out` when the connection uses TLS, then writes it all
+    coro::Task<int> send_output(Shard& shard, sys::native_handle_t fd, tls::TlsSession& tls, core::IOBuf out) {
+        if (m_use_tls && !out.empty()) {
+            core::IOBuf encrypted(shard.pool);
+            if (tls.encrypt(out, encrypted) < 0) co_return -EIO;
+            out = std::move(encrypted);
+        }
+        co_return co_await write_all(shard, fd, std::move(out));
+    }
+
+    // Writes the whole chain, with zero-copy send once it is large enough.
+    // Returns the bytes written or -errno.
+    coro::Task<int> write_all(Shard& shard, sys::native_handle_t fd, core::IOBuf out) {
+        if (out.empty()) co_return 0;
+        int sent;
+        if (use_zero_copy(out.size())) {
+            sent = co_await async_send_zc(shard.ring, fd, std::move(out));
+        } else {
+            sent = co_await async_write(shard.ring, fd, out);
+        }
+        co_return sent > 0 ? sent : (sent == 0 ? -EPIPE : sent);
+    }
+
+    coro::Task<> udp_listener(Shard& shard) {
+        Shard::TaskScope scope(shard);
+        coro::CancellationToken stop = shard.shutdown.token();
         quic::UdpSocket sock;
         sock.init(m_port);
-        m_ring.attach(sock.fd);
+        shard.ring.attach(sock.fd);
         quic::Engine engine;
         
         std::cout << "[Server] UDP/QUIC Listener on " << m_port << std::endl;
 
-        while (true) {
+        while (!stop.cancelled()) {
             char buffer[1500];
-            sockaddr_in client_addr;
-            int client_len = sizeof(client_addr);
-            sys::NativeOverlapped ov;
-            ov.user_data = nullptr;
-
-            co_await async_recvfrom(sock.fd, buffer, sizeof(buffer), (sockaddr*)&client_addr, &client_len, &ov);
+            coro::RecvFromResult packet = co_await async_recvfrom(shard.ring, sock.fd, buffer, sizeof(buffer)).cancel_on(stop);
             
-            if (ov.result > 0) {
-                engine.on_packet((uint8_t*)buffer, ov.result, (sockaddr*)&client_addr);
+            if (packet.result > 0) {
+                engine.on_packet((uint8_t*)buffer, packet.result, (sockaddr*)&packet.peer);
             }
         }
     }
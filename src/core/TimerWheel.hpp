@@ -0,0 +1,161 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+namespace core {
+
+// Intrusive timer node. Embed it in whatever needs a deadline; it must stay at
+// a stable address while scheduled.
+struct Timer {
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    uint64_t expires = 0; // Absolute tick (ms)
+
+    void (*on_expire)(Timer* t) = nullptr;
+    void* user_data = nullptr;
+
+    bool scheduled() const { return prev != nullptr; }
+};
+
+// Hierarchical timing wheel with 1 ms ticks: 4 levels of 64 slots cover ~4.6
+// hours. Insert and cancel are O(1); timers on outer levels are cascaded
+// inwards as time reaches their slot.
+class TimerWheel {
+public:
+    static constexpr unsigned LEVELS = 4;
+    static constexpr unsigned SLOT_BITS = 6;
+    static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+    static constexpr uint64_t NEVER = UINT64_MAX;
+
+    explicit TimerWheel(uint64_t now = 0) : m_now(now) {
+        for (auto& level : m_slots) {
+            for (auto& head : level) head.prev = head.next = &head;
+        }
+    }
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    uint64_t now() const { return m_now; }
+    bool empty() const { return m_count == 0; }
+    size_t size() const { return m_count; }
+
+    void schedule(Timer& t, uint64_t expires) {
+        if (t.scheduled()) cancel(t);
+        t.expires = expires > m_now ? expires : m_now + 1;
+        insert(t);
+        m_count++;
+    }
+
+    void cancel(Timer& t) {
+        if (!t.scheduled()) return;
+        unlink(t);
+        m_count--;
+    }
+
+    // Moves time forward to `now`, firing every timer that expired on the way.
+    // Callbacks may schedule or cancel timers.
+    void advance(uint64_t now) {
+        while (m_now < now) {
+            if (m_count == 0) {
+                m_now = now;
+                return;
+            }
+            tick();
+        }
+    }
+
+    // Earliest tick at which advance() has work to do (a timer fires or a slot
+    // cascades), or NEVER.
+    uint64_t next_expiry() const {
+        if (m_count == 0) return NEVER;
+
+        uint64_t best = NEVER;
+        for (unsigned level = 0; level < LEVELS; ++level) {
+            unsigned shift = level * SLOT_BITS;
+            uint64_t index = m_now >> shift;
+            for (uint64_t d = 1; d < SLOTS; ++d) {
+                const Timer& head = m_slots[level][(index + d) & (SLOTS - 1)];
+                if (head.next != &head) {
+                    uint64_t at = (index + d) << shift;
+                    if (at < best) best = at;
+                    break;
+                }
+            }
+        }
+        return best;
+    }
+
+private:
+    void insert(Timer& t) {
+        unsigned level = 0;
+        for (; level < LEVELS - 1; ++level) {
+            unsigned shift = level * SLOT_BITS;
+            if ((t.expires >> shift) - (m_now >> shift) < SLOTS) break;
+        }
+
+        unsigned shift = level * SLOT_BITS;
+        uint64_t index = t.expires >> shift;
+        uint64_t last = (m_now >> shift) + SLOTS - 1;
+        if (index > last) index = last; // Beyond the wheel: re-cascaded until it fits
+
+        Timer& head = m_slots[level][index & (SLOTS - 1)];
+        t.prev = head.prev;
+        t.next = &head;
+        head.prev->next = &t;
+        head.prev = &t;
+    }
+
+    static void unlink(Timer& t) {
+        t.prev->next = t.next;
+        t.next->prev = t.prev;
+        t.prev = t.next = nullptr;
+    }
+
+    // Detaches every timer in a slot into `out` so callbacks can freely
+    // modify the wheel while we walk the list
+    static void take(Timer& head, Timer& out) {
+        out.prev = out.next = &out;
+        if (head.next == &head) return;
+        out.next = head.next;
+        out.prev = head.prev;
+        out.next->prev = &out;
+        out.prev->next = &out;
+        head.prev = head.next = &head;
+    }
+
+    void tick() {
+        m_now++;
+
+        // Cascade outer levels whose slot boundary we just crossed, outermost first
+        unsigned top = 0;
+        while (top + 1 < LEVELS && (m_now & ((uint64_t(1) << ((top + 1) * SLOT_BITS)) - 1)) == 0) {
+            top++;
+        }
+        for (unsigned level = top; level >= 1; --level) {
+            Timer list;
+            take(m_slots[level][(m_now >> (level * SLOT_BITS)) & (SLOTS - 1)], list);
+            while (list.next != &list) {
+                Timer* t = list.next;
+                unlink(*t);
+                insert(*t);
+            }
+        }
+
+        Timer expired;
+        take(m_slots[0][m_now & (SLOTS - 1)], expired);
+        while (expired.next != &expired) {
+            Timer* t = expired.next;
+            unlink(*t);
+            m_count--;
+            if (t->on_expire) t->on_expire(t);
+        }
+    }
+
+    uint64_t m_now;
+    size_t m_count = 0;
+    std::array<std::array<Timer, SLOTS>, LEVELS> m_slots;
+};
+
+}
@@ -0,0 +1,237 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace core {
+
+// Chase-Lev work-stealing deque of pointers. The owning thread pushes and
+// pops at the bottom without contention; other threads steal from the top,
+// racing only with each other (and with the owner for the last item). The
+// array grows by doubling; replaced arrays are kept until the deque dies,
+// since a thief may still be reading one.
+template <typename T>
+class WorkStealingDeque {
+    struct Array {
+        int64_t capacity;
+        std::unique_ptr<std::atomic<T*>[]> slots;
+
+        explicit Array(int64_t cap) : capacity(cap), slots(new std::atomic<T*>[cap]) {}
+        T* get(int64_t i) const { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(int64_t i, T* v) { slots[i & (capacity - 1)].store(v, std::memory_order_relaxed); }
+    };
+
+public:
+    explicit WorkStealingDeque(int64_t capacity = 256) {
+        m_arrays.push_back(std::make_unique<Array>(capacity));
+        m_array.store(m_arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner only
+    void push(T* item) {
+        int64_t b = m_bottom.load(std::memory_order_relaxed);
+        int64_t t = m_top.load(std::memory_order_acquire);
+        Array* a = m_array.load(std::memory_order_relaxed);
+        if (b - t > a->capacity - 1) a = grow(a, t, b);
+        a->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner only. Newest item first, nullptr when empty.
+    T* pop() {
+        int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+        Array* a = m_array.load(std::memory_order_relaxed);
+        m_bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = m_top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        T* item = a->get(b);
+        if (t == b) {
+            // Last item: a thief may be after it too
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) item = nullptr;
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    // Any thread. Oldest item first; nullptr when empty or when another thread won the race.
+    T* steal() {
+        int64_t t = m_top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = m_bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+
+        Array* a = m_array.load(std::memory_order_acquire);
+        T* item = a->get(t);
+        if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) return nullptr;
+        return item;
+    }
+
+    bool empty() const {
+        return m_bottom.load(std::memory_order_relaxed) <= m_top.load(std::memory_order_relaxed);
+    }
+
+private:
+    Array* grow(Array* old, int64_t t, int64_t b) {
+        auto bigger = std::make_unique<Array>(old->capacity * 2);
+        for (int64_t i = t; i < b; ++i) bigger->put(i, old->get(i));
+        Array* a = bigger.get();
+        m_arrays.push_back(std::move(bigger));
+        m_array.store(a, std::memory_order_release);
+        return a;
+    }
+
+    alignas(64) std::atomic<int64_t> m_top{ 0 };
+    alignas(64) std::atomic<int64_t> m_bottom{ 0 };
+    std::atomic<Array*> m_array;
+    std::vector<std::unique_ptr<Array>> m_arrays; // Owner only
+};
+
+// Threads for CPU-bound work that would otherwise stall a ring. Each worker
+// owns a work-stealing deque: jobs submitted from a worker go onto its own
+// deque, jobs from anywhere else (the rings) onto a shared queue that idle
+// workers drain in batches, moving the surplus onto their deque for others
+// to steal. Workers with nothing to run or steal sleep until a job arrives.
+class WorkerPool {
+public:
+    // Intrusive job: embed it and set `run`. It must stay alive until run.
+    struct Job {
+        void (*run)(Job* job) = nullptr;
+    };
+
+    // 0 = one per online CPU
+    explicit WorkerPool(unsigned threads = 0) {
+        if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+        m_workers.reserve(threads);
+        for (unsigned i = 0; i < threads; ++i) m_workers.push_back(std::make_unique<Worker>());
+        for (unsigned i = 0; i < threads; ++i) {
+            m_workers[i]->thread = std::thread([this, i] { run_worker(i); });
+        }
+    }
+
+    // Jobs still queued are dropped
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_stop = true;
+        }
+        m_wake.notify_all();
+        for (auto& w : m_workers) w->thread.join();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(m_workers.size()); }
+
+    // Safe from any thread
+    void submit(Job* job) {
+        // Counted before it is published: a worker may take the job as soon as
+        // it is visible, and its decrement must not run ahead of this one
+        m_queued.fetch_add(1, std::memory_order_seq_cst);
+        if (t_pool == this) {
+            m_workers[t_index]->deque.push(job);
+        } else {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_injected.push_back(job);
+        }
+        if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+            // Taking the lock orders this against a worker between its last check and its wait
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_wake.notify_one();
+        }
+    }
+
+private:
+    static constexpr size_t MAX_BATCH = 32;
+
+    struct Worker {
+        WorkStealingDeque<Job> deque;
+        std::thread thread;
+    };
+
+    void run_worker(unsigned index) {
+        t_pool = this;
+        t_index = index;
+        while (Job* job = next_job(index)) {
+            m_queued.fetch_sub(1, std::memory_order_relaxed);
+            try {
+                job->run(job);
+            } catch (const std::exception& e) {
+                std::cerr << "[WorkerPool] Job failed: " << e.what() << "\n";
+            } catch (...) {
+                std::cerr << "[WorkerPool] Job failed\n";
+            }
+        }
+    }
+
+    // Own deque, then the shared queue, then the other workers. Blocks while
+    // there is nothing anywhere; returns nullptr once the pool stops.
+    Job* next_job(unsigned index) {
+        Worker& self = *m_workers[index];
+        while (true) {
+            if (Job* job = self.deque.pop()) return job;
+            if (Job* job = take_injected(self)) return job;
+            if (Job* job = steal(index)) return job;
+
+            std::unique_lock<std::mutex> lock(m_lock);
+            m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            m_wake.wait(lock, [this] { return m_stop || m_queued.load(std::memory_order_seq_cst) > 0; });
+            m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+            if (m_stop) return nullptr;
+        }
+    }
+
+    // Takes a fair share of the shared queue: one job to run, the rest onto our deque
+    Job* take_injected(Worker& self) {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (m_injected.empty()) return nullptr;
+        size_t n = std::min(MAX_BATCH, m_injected.size() / m_workers.size() + 1);
+        Job* first = m_injected.front();
+        m_injected.pop_front();
+        for (size_t i = 1; i < n; ++i) {
+            self.deque.push(m_injected.front());
+            m_injected.pop_front();
+        }
+        return first;
+    }
+
+    Job* steal(unsigned index) {
+        size_t count = m_workers.size();
+        for (size_t i = 1; i < count; ++i) {
+            Worker& victim = *m_workers[(index + i) % count];
+            if (Job* job = victim.deque.steal()) return job;
+        }
+        return nullptr;
+    }
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::deque<Job*> m_injected; // Jobs from non-worker threads
+    bool m_stop = false;
+
+    std::atomic<size_t> m_queued{ 0 };     // Submitted and not yet started
+    std::atomic<unsigned> m_sleeping{ 0 };
+
+    static inline thread_local WorkerPool* t_pool = nullptr;
+    static inline thread_local unsigned t_index = 0;
+};
+
+}
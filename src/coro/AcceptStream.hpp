@@ -0,0 +1,101 @@
+#pragma once
+#include "Cancellation.hpp"
+#include "../core/Ring.hpp"
+#include "../sys/Platform.hpp"
+#include <coroutine>
+#include <deque>
+#include <utility>
+#include <cerrno>
+
+#ifdef PLATFORM_LINUX
+
+namespace coro {
+
+// Multishot accept: a single armed SQE streams accepted sockets into a queue,
+// and `co_await stream.next()` pops them one at a time. The SQE is only
+// re-armed when the kernel terminates the multishot (no IORING_CQE_F_MORE).
+class AcceptStream {
+public:
+    AcceptStream(core::Ring& ring, sys::native_handle_t listen_fd) : m_ring(ring), m_listen_fd(listen_fd) {
+        m_ov.user_data = this;
+        m_ov.on_complete = &AcceptStream::on_complete;
+    }
+
+    AcceptStream(const AcceptStream&) = delete;
+    AcceptStream& operator=(const AcceptStream&) = delete;
+
+    struct NextAwaitable {
+        AcceptStream& stream;
+        CancellationToken token;
+        CancellationRegistration cancel;
+
+        bool await_ready() {
+            if (stream.m_ready.empty() && token.cancelled() && !stream.m_armed) {
+                stream.m_ready.push_back(-ECANCELED);
+            }
+            return !stream.m_ready.empty();
+        }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            stream.m_waiter = h;
+            if (token.cancelled()) {
+                // Still armed: wait for the multishot's final completion
+                stream.m_ring.submit_cancel(stream.m_listen_fd, &stream.m_ov);
+                return;
+            }
+            if (!stream.m_armed) {
+                stream.m_armed = true;
+                stream.m_ring.submit_accept_multishot(stream.m_listen_fd, &stream.m_ov);
+            }
+            if (token.can_be_cancelled()) cancel.attach(token, &AcceptStream::on_cancel, &stream);
+        }
+
+        // Accepted fd (tagged with Ring::DIRECT_FD for direct descriptors), or -errno
+        // for a failed accept
+        int await_resume() {
+            cancel.reset();
+            int fd = stream.m_ready.front();
+            stream.m_ready.pop_front();
+            return fd;
+        }
+    };
+
+    // Once `token` is cancelled the multishot accept is cancelled; it yields
+    // -ECANCELED after the connections that were already queued. A later
+    // next() with a live token re-arms it.
+    NextAwaitable next(CancellationToken token = {}) { return NextAwaitable{ *this, std::move(token), {} }; }
+
+private:
+    static void on_cancel(void* ctx) {
+        AcceptStream* self = static_cast<AcceptStream*>(ctx);
+        self->m_ring.submit_cancel(self->m_listen_fd, &self->m_ov);
+    }
+
+    static void on_complete(sys::NativeOverlapped* ov, int result, uint32_t flags) {
+        AcceptStream* self = static_cast<AcceptStream*>(ov->user_data);
+        if (!(flags & IORING_CQE_F_MORE)) {
+            self->m_armed = false;
+        }
+        if (result >= 0 && self->m_ring.uses_direct_descriptors()) {
+            result |= core::Ring::DIRECT_FD;
+        }
+        self->m_ready.push_back(result);
+
+        if (self->m_waiter) {
+            std::coroutine_handle<> waiter = self->m_waiter;
+            self->m_waiter = nullptr;
+            waiter.resume();
+        }
+    }
+
+    core::Ring& m_ring;
+    sys::native_handle_t m_listen_fd;
+    sys::NativeOverlapped m_ov;
+    bool m_armed = false;
+    std::deque<int> m_ready;
+    std::coroutine_handle<> m_waiter;
+};
+
+}
+
+#endif
@@ -0,0 +1,146 @@
+#pragma once
+#include "../core/Ring.hpp"
+#include "../core/TimerWheel.hpp"
+#include <cstdint>
+#include <utility>
+
+namespace coro {
+
+class CancellationToken;
+class CancellationRegistration;
+
+namespace detail {
+
+struct CancellationState {
+    unsigned refs = 1;
+    bool requested = false;
+    CancellationRegistration* head = nullptr;
+};
+
+}
+
+// Runs a callback when its token is cancelled. The callback only fires while
+// the registration is attached; destroying or reset()ing it detaches it.
+class CancellationRegistration {
+public:
+    using Callback = void (*)(void* ctx);
+
+    CancellationRegistration() = default;
+    ~CancellationRegistration() { reset(); }
+
+    CancellationRegistration(const CancellationRegistration&) = delete;
+    CancellationRegistration& operator=(const CancellationRegistration&) = delete;
+
+    // Calls `fn` right away if cancellation was already requested
+    inline void attach(const CancellationToken& token, Callback fn, void* ctx);
+
+    void reset() {
+        if (!m_state) return;
+        if (m_prev) m_prev->m_next = m_next;
+        else m_state->head = m_next;
+        if (m_next) m_next->m_prev = m_prev;
+        m_state = nullptr;
+        m_prev = m_next = nullptr;
+    }
+
+private:
+    friend class CancellationSource;
+
+    detail::CancellationState* m_state = nullptr;
+    Callback m_fn = nullptr;
+    void* m_ctx = nullptr;
+    CancellationRegistration* m_prev = nullptr;
+    CancellationRegistration* m_next = nullptr;
+};
+
+// Observes a CancellationSource. A default-constructed token is never
+// cancelled. Cheap to copy; keeps the shared state alive on its own.
+class CancellationToken {
+public:
+    CancellationToken() = default;
+    CancellationToken(const CancellationToken& other) : m_state(other.m_state) { if (m_state) m_state->refs++; }
+    CancellationToken(CancellationToken&& other) noexcept : m_state(std::exchange(other.m_state, nullptr)) {}
+    CancellationToken& operator=(CancellationToken other) noexcept {
+        std::swap(m_state, other.m_state);
+        return *this;
+    }
+    ~CancellationToken() { release(m_state); }
+
+    bool cancelled() const { return m_state && m_state->requested; }
+    bool can_be_cancelled() const { return m_state != nullptr; }
+
+private:
+    friend class CancellationSource;
+    friend class CancellationRegistration;
+
+    explicit CancellationToken(detail::CancellationState* state) : m_state(state) { m_state->refs++; }
+
+    static void release(detail::CancellationState* state) {
+        if (state && --state->refs == 0) delete state;
+    }
+
+    detail::CancellationState* m_state = nullptr;
+};
+
+// Cancels in-flight operations that were given one of its tokens: each one is
+// cancelled on its ring (IORING_OP_ASYNC_CANCEL / CancelIoEx) and resumes its
+// coroutine with -ECANCELED. A source and its tokens belong to one ring's
+// thread; to cancel from elsewhere, post request_cancel() to that ring.
+class CancellationSource {
+public:
+    CancellationSource() : m_state(new detail::CancellationState) {}
+    ~CancellationSource() {
+        if (m_timer_ring) m_timer_ring->cancel_timer(m_timer);
+        CancellationToken::release(m_state);
+    }
+
+    CancellationSource(const CancellationSource&) = delete;
+    CancellationSource& operator=(const CancellationSource&) = delete;
+
+    CancellationToken token() const { return CancellationToken(m_state); }
+    bool cancelled() const { return m_state->requested; }
+
+    // Runs every attached callback once; later attaches fire immediately
+    void request_cancel() {
+        if (m_state->requested) return;
+        m_state->requested = true;
+        // Each registration is detached before its callback runs, so callbacks may destroy anything
+        while (CancellationRegistration* r = m_state->head) {
+            CancellationRegistration::Callback fn = r->m_fn;
+            void* ctx = r->m_ctx;
+            r->reset();
+            fn(ctx);
+        }
+    }
+
+    // Requests cancellation after `ms` on `ring` (timer wheel resolution)
+    void cancel_after(core::Ring& ring, uint64_t ms) {
+        if (m_timer_ring) m_timer_ring->cancel_timer(m_timer);
+        m_timer_ring = &ring;
+        m_timer.user_data = this;
+        m_timer.on_expire = [](core::Timer* t) { static_cast<CancellationSource*>(t->user_data)->request_cancel(); };
+        ring.add_timer(m_timer, ms);
+    }
+
+private:
+    detail::CancellationState* m_state;
+    core::Timer m_timer;
+    core::Ring* m_timer_ring = nullptr;
+};
+
+inline void CancellationRegistration::attach(const CancellationToken& token, Callback fn, void* ctx) {
+    reset();
+    if (!token.m_state) return;
+    if (token.m_state->requested) {
+        fn(ctx);
+        return;
+    }
+    m_state = token.m_state;
+    m_fn = fn;
+    m_ctx = ctx;
+    m_next = m_state->head;
+    if (m_next) m_next->m_prev = this;
+    m_state->head = this;
+}
+
+}
@@ -0,0 +1,261 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace coro {
+
+struct FrameStats {
+    static constexpr unsigned BUCKETS = 11; // 64 B .. 64 KiB, powers of two
+
+    struct Bucket {
+        size_t frame_size = 0;
+        uint64_t allocations = 0;
+        uint64_t fresh = 0;      // Served by the global allocator (free list was empty)
+        uint64_t live = 0;
+        uint64_t high_water = 0;
+        uint64_t cached = 0;     // Free frames waiting for reuse
+    };
+
+    std::array<Bucket, BUCKETS> buckets;
+    uint64_t oversize = 0;       // Frames above 64 KiB, always from the global allocator
+    uint64_t remote_frees = 0;   // Frames freed by a thread other than the one that allocated them
+    size_t largest = 0;          // Largest frame requested
+};
+
+// Coroutine frame allocator. Each thread (and so each ring) keeps free lists
+// of frames bucketed by size; a freed frame goes back to the list of the
+// thread that allocated it, so steady accept/close churn never reaches the
+// global allocator. Frames freed on another thread are pushed onto the owner's
+// lock-free remote list and picked up on its next allocation of that size.
+class FrameAllocator {
+public:
+    static constexpr size_t MIN_FRAME = 64;
+    static constexpr size_t MAX_FRAME = 64 * 1024;
+    static constexpr size_t MAX_CACHED_BYTES = 16 * 1024 * 1024; // Per thread; beyond this frees go to the global allocator
+
+    class Cache;
+
+    static void* allocate(size_t size) {
+        Cache* cache = local();
+        return cache->allocate(size);
+    }
+
+    static void deallocate(void* ptr) noexcept {
+        if (!ptr) return;
+        Header* h = static_cast<Header*>(ptr) - 1;
+        if (h->bucket == OVERSIZE) {
+            ::operator delete(h);
+            return;
+        }
+        if (h->owner == t_cache) {
+            h->owner->free_local(h);
+        } else {
+            h->owner->free_remote(h);
+        }
+    }
+
+    // The calling thread's cache; pass it to stats() from any thread while that thread runs
+    static const Cache* current() { return local(); }
+    static FrameStats stats(const Cache* cache) { return cache->stats(); }
+
+private:
+    static constexpr uint32_t OVERSIZE = UINT32_MAX;
+    static constexpr unsigned BUCKETS = FrameStats::BUCKETS;
+
+    struct alignas(std::max_align_t) Header {
+        Cache* owner;
+        uint32_t bucket;
+    };
+
+    // Free list link, kept in the first bytes of an unused frame
+    static Header*& next_of(Header* h) { return *reinterpret_cast<Header**>(h + 1); }
+
+    static constexpr unsigned bucket_of(size_t size) {
+        return size <= MIN_FRAME ? 0 : static_cast<unsigned>(std::bit_width(size - 1) - std::bit_width(MIN_FRAME - 1));
+    }
+    static constexpr size_t bucket_size(unsigned bucket) { return MIN_FRAME << bucket; }
+
+public:
+    class Cache {
+    public:
+        Cache(const Cache&) = delete;
+        Cache& operator=(const Cache&) = delete;
+
+    private:
+        friend class FrameAllocator;
+
+        // Counters are written only by the owning thread; relaxed atomics let others read them
+        struct Counters {
+            std::atomic<uint64_t> allocations{ 0 };
+            std::atomic<uint64_t> fresh{ 0 };
+            std::atomic<uint64_t> live{ 0 };
+            std::atomic<uint64_t> high_water{ 0 };
+            std::atomic<uint64_t> cached{ 0 };
+        };
+
+        Cache() = default;
+
+        ~Cache() {
+            for (Header*& head : m_free) release_list(head);
+            Header* remote = m_remote.exchange(nullptr, std::memory_order_acquire);
+            release_list(remote);
+        }
+
+        static void bump(std::atomic<uint64_t>& c, int64_t delta) {
+            c.store(c.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+        }
+
+        void* allocate(size_t size) {
+            if (size > m_largest.load(std::memory_order_relaxed)) m_largest.store(size, std::memory_order_relaxed);
+
+            if (size > MAX_FRAME) {
+                bump(m_oversize, 1);
+                Header* h = static_cast<Header*>(::operator new(sizeof(Header) + size));
+                h->owner = nullptr;
+                h->bucket = OVERSIZE;
+                return h + 1;
+            }
+
+            unsigned bucket = bucket_of(size);
+            Counters& c = m_counters[bucket];
+            if (!m_free[bucket]) collect_remote();
+
+            Header* h = m_free[bucket];
+            if (h) {
+                m_free[bucket] = next_of(h);
+                m_cached_bytes -= bucket_size(bucket);
+                bump(c.cached, -1);
+            } else {
+                h = static_cast<Header*>(::operator new(sizeof(Header) + bucket_size(bucket)));
+                h->owner = this;
+                h->bucket = bucket;
+                bump(c.fresh, 1);
+            }
+
+            m_outstanding.fetch_add(1, std::memory_order_relaxed);
+            bump(c.allocations, 1);
+            uint64_t live = c.live.load(std::memory_order_relaxed) + 1;
+            c.live.store(live, std::memory_order_relaxed);
+            if (live > c.high_water.load(std::memory_order_relaxed)) c.high_water.store(live, std::memory_order_relaxed);
+            return h + 1;
+        }
+
+        void free_local(Header* h) {
+            Counters& c = m_counters[h->bucket];
+            bump(c.live, -1);
+            if (m_cached_bytes + bucket_size(h->bucket) <= MAX_CACHED_BYTES) {
+                next_of(h) = m_free[h->bucket];
+                m_free[h->bucket] = h;
+                m_cached_bytes += bucket_size(h->bucket);
+                bump(c.cached, 1);
+            } else {
+                ::operator delete(h);
+            }
+            // The owning thread holds a reference, so this never reaches zero here
+            m_outstanding.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void free_remote(Header* h) {
+            if (m_retired.load(std::memory_order_acquire)) {
+                ::operator delete(h);
+            } else {
+                Header* head = m_remote.load(std::memory_order_relaxed);
+                do {
+                    next_of(h) = head;
+                } while (!m_remote.compare_exchange_weak(head, h, std::memory_order_release, std::memory_order_relaxed));
+            }
+            unref();
+        }
+
+        // Moves frames freed by other threads onto the local lists
+        void collect_remote() {
+            Header* h = m_remote.exchange(nullptr, std::memory_order_acquire);
+            while (h) {
+                Header* next = next_of(h);
+                Counters& c = m_counters[h->bucket];
+                bump(c.live, -1);
+                bump(m_remote_frees, 1);
+                next_of(h) = m_free[h->bucket];
+                m_free[h->bucket] = h;
+                m_cached_bytes += bucket_size(h->bucket);
+                bump(c.cached, 1);
+                h = next;
+            }
+        }
+
+        // The owning thread is exiting: frames still out are freed straight to the
+        // global allocator, and the last one out deletes the cache
+        void retire() {
+            for (Header*& head : m_free) release_list(head);
+            m_retired.store(true, std::memory_order_release);
+            unref();
+        }
+
+        void unref() {
+            if (m_outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+        }
+
+        static void release_list(Header*& head) {
+            while (head) {
+                Header* next = next_of(head);
+                ::operator delete(head);
+                head = next;
+            }
+        }
+
+        FrameStats stats() const {
+            FrameStats out;
+            for (unsigned b = 0; b < BUCKETS; ++b) {
+                const Counters& c = m_counters[b];
+                FrameStats::Bucket& s = out.buckets[b];
+                s.frame_size = bucket_size(b);
+                s.allocations = c.allocations.load(std::memory_order_relaxed);
+                s.fresh = c.fresh.load(std::memory_order_relaxed);
+                s.live = c.live.load(std::memory_order_relaxed);
+                s.high_water = c.high_water.load(std::memory_order_relaxed);
+                s.cached = c.cached.load(std::memory_order_relaxed);
+            }
+            out.oversize = m_oversize.load(std::memory_order_relaxed);
+            out.remote_frees = m_remote_frees.load(std::memory_order_relaxed);
+            out.largest = m_largest.load(std::memory_order_relaxed);
+            return out;
+        }
+
+        std::array<Header*, BUCKETS> m_free{};
+        size_t m_cached_bytes = 0;
+        std::atomic<Header*> m_remote{ nullptr };
+        std::atomic<size_t> m_outstanding{ 1 }; // Frames out, plus one for the owning thread
+        std::atomic<bool> m_retired{ false };
+
+        std::array<Counters, BUCKETS> m_counters;
+        std::atomic<uint64_t> m_oversize{ 0 };
+        std::atomic<uint64_t> m_remote_frees{ 0 };
+        std::atomic<size_t> m_largest{ 0 };
+    };
+
+private:
+    struct Owner {
+        bool armed;
+        ~Owner() {
+            if (t_cache) t_cache->retire();
+            t_cache = nullptr;
+        }
+    };
+
+    static Cache* local() {
+        if (!t_cache) {
+            t_cache = new Cache();
+            t_owner.armed = true; // First use registers the thread-exit hook
+        }
+        return t_cache;
+    }
+
+    static inline thread_local Cache* t_cache = nullptr;
+    static inline thread_local Owner t_owner;
+};
+
+}
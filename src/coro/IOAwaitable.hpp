@@ -1,57 +1,301 @@
 #pragma once
+#include "Cancellation.hpp"
 #include "../core/Ring.hpp"
 #include "../sys/Platform.hpp"
 #include <coroutine>
+#include <cerrno>
+#include <utility>
 
 namespace coro {
 
-struct IOAwaitable {
-    core::Ring& ring;
-    sys::native_handle_t fd;
-    void* buf;
-    size_t len;
-   
-    int op_type; 
-    sys::NativeOverlapped* ov;
+namespace detail {
 
-  
-    struct sockaddr* client_addr;
-    int* client_len;
+// Single-completion operation on `m_fd`. The completion record lives in the
+// awaitable (and so in the awaiting coroutine's frame); `Op` supplies
+// submit(ov), which calls the matching Ring::submit_*, and result(res), which
+// turns the raw completion into the value co_await yields. Both are bound at
+// compile time.
+template <typename Op>
+class IOAwaitable {
+public:
+    // Movable until it is awaited: nothing refers to the completion record
+    // before the operation is submitted. (GCC moves the operand of co_await
+    // when it is not a prvalue, e.g. the result of cancel_on().)
+    IOAwaitable(IOAwaitable&& other) noexcept : m_ring(other.m_ring), m_fd(other.m_fd), m_ov(other.m_ov), m_token(std::move(other.m_token)) {}
+    IOAwaitable& operator=(const IOAwaitable&) = delete;
 
-   
-    sys::os_fd_t file_fd;
-    size_t offset;
+    // `co_await op.cancel_on(token)`: once the token is cancelled the operation
+    // is cancelled too and yields -ECANCELED (unless it completed first)
+    Op&& cancel_on(const CancellationToken& token) {
+        m_token = token;
+        return static_cast<Op&&>(*this);
+    }
+
+    bool await_ready() {
+        if (!m_token.cancelled()) return false;
+        m_ov.result = -ECANCELED; // Never submitted
+        return true;
+    }
 
-   
-    int result;
+    void await_suspend(std::coroutine_handle<> h) {
+        m_ov.user_data = h.address();
+        static_cast<Op*>(this)->submit(&m_ov);
+        if (m_token.can_be_cancelled()) m_cancel.attach(m_token, &IOAwaitable::on_cancel, this);
+    }
 
-    IOAwaitable(core::Ring& r, sys::native_handle_t f, void* b, size_t l, sys::NativeOverlapped* o)
-        : ring(r), fd(f), buf(b), len(l), op_type(0), ov(o), server_fd(0), client_addr(nullptr), client_len(nullptr), file_fd(0), offset(0), result(0) {}
+    auto await_resume() {
+        m_cancel.reset();
+        int res = m_ov.result;
+#ifdef PLATFORM_WINDOWS
+        // IOCP reports a cancelled operation as 0 bytes transferred
+        if (m_cancelled && res == 0) res = -ECANCELED;
+#endif
+        return static_cast<Op*>(this)->result(res);
+    }
 
-   
-    sys::native_handle_t server_fd; 
+protected:
+    IOAwaitable(core::Ring& ring, sys::native_handle_t fd) : m_ring(ring), m_fd(fd) {}
 
-    bool await_ready() { return false; }
+    core::Ring& m_ring;
+    sys::native_handle_t m_fd;
+    sys::NativeOverlapped m_ov;
 
-    void await_suspend(std::coroutine_handle<> h) {
-        ov->user_data = h.address();
-        
-        if (op_type == 0) { 
-            ring.submit_read(fd, buf, len, ov);
-        } else if (op_type == 1) { 
-            ring.submit_write(fd, buf, len, ov);
-        } else if (op_type == 2) { 
-            ring.submit_accept(fd, client_addr, client_len, ov);
-        } else if (op_type == 3) { 
-            ring.submit_sendfile(file_fd, fd, offset, len, ov);
-        } else if (op_type == 4) {
-            ring.submit_recvfrom(fd, buf, len, client_addr, client_len, ov);
+private:
+    static void on_cancel(void* ctx) {
+        IOAwaitable* self = static_cast<IOAwaitable*>(ctx);
+        self->m_cancelled = true;
+        self->m_ring.submit_cancel(self->m_fd, &self->m_ov);
+    }
+
+    CancellationToken m_token;
+    CancellationRegistration m_cancel;
+    bool m_cancelled = false;
+};
+
+}
+
+// Bytes read, 0 on EOF, or -errno
+class ReadAwaitable : public detail::IOAwaitable<ReadAwaitable> {
+public:
+    ReadAwaitable(core::Ring& ring, sys::native_handle_t fd, void* buf, size_t len)
+        : IOAwaitable(ring, fd), m_buf(buf), m_len(len) {}
+
+private:
+    friend IOAwaitable;
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_read(m_fd, m_buf, m_len, ov); }
+    int result(int res) const { return res; }
+
+    void* m_buf;
+    size_t m_len;
+};
+
+// Bytes written (possibly short) or -errno
+class WriteAwaitable : public detail::IOAwaitable<WriteAwaitable> {
+public:
+    WriteAwaitable(core::Ring& ring, sys::native_handle_t fd, const void* buf, size_t len)
+        : IOAwaitable(ring, fd), m_buf(buf), m_len(len) {}
+
+private:
+    friend IOAwaitable;
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_write(m_fd, m_buf, m_len, ov); }
+    int result(int res) const { return res; }
+
+    const void* m_buf;
+    size_t m_len;
+};
+
+struct AcceptResult {
+    sys::native_handle_t fd = sys::INVALID_HANDLE_VALUE_NET;
+    int error = 0; // -errno when fd is invalid (-ECANCELED only, on Windows)
+    sockaddr_storage peer{};
+    int peer_len = 0;
+};
+
+// One accepted connection with its peer address
+class AcceptAwaitable : public detail::IOAwaitable<AcceptAwaitable> {
+public:
+    AcceptAwaitable(core::Ring& ring, sys::native_handle_t listen_fd) : IOAwaitable(ring, listen_fd) {
+#ifdef PLATFORM_WINDOWS
+        m_ov.client_socket = sys::INVALID_HANDLE_VALUE_NET;
+#endif
+    }
+
+private:
+    friend IOAwaitable;
+
+#ifdef PLATFORM_WINDOWS
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_accept(m_fd, m_addresses, nullptr, ov); }
+
+    AcceptResult result(int res) {
+        AcceptResult r;
+        if (res < 0) {
+            if (m_ov.client_socket != sys::INVALID_HANDLE_VALUE_NET) closesocket(m_ov.client_socket);
+            r.error = res;
+            return r;
+        }
+        r.fd = m_ov.client_socket;
+        if (r.fd == sys::INVALID_HANDLE_VALUE_NET) return r;
+        // Lets the accepted socket use getpeername/shutdown like any other
+        setsockopt(r.fd, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char*)&m_fd, sizeof(m_fd));
+        r.peer_len = sizeof(r.peer);
+        getpeername(r.fd, (sockaddr*)&r.peer, &r.peer_len);
+        return r;
+    }
+
+    char m_addresses[2 * (sizeof(sockaddr_in) + 16)]; // AcceptEx writes both ends here
+#else
+    void submit(sys::NativeOverlapped* ov) {
+        m_peer_len = sizeof(m_peer);
+        m_ring.submit_accept(m_fd, &m_peer, &m_peer_len, ov);
+    }
+
+    AcceptResult result(int res) const {
+        AcceptResult r;
+        if (res < 0) {
+            r.error = res;
+            return r;
         }
+        r.fd = res;
+        r.peer = m_peer;
+        r.peer_len = m_peer_len;
+        return r;
+    }
+
+    sockaddr_storage m_peer;
+    int m_peer_len = 0;
+#endif
+};
+
+// Sends `count` bytes of a file: TransmitFile on Windows (with `head` in
+// front), splice into a pipe on Linux. See Ring::submit_sendfile.
+class SendfileAwaitable : public detail::IOAwaitable<SendfileAwaitable> {
+public:
+    SendfileAwaitable(core::Ring& ring, sys::native_handle_t socket_fd, sys::os_fd_t file_fd, size_t offset, size_t count,
+                      const void* head = nullptr, size_t head_len = 0)
+        : IOAwaitable(ring, socket_fd), m_file_fd(file_fd), m_offset(offset), m_count(count), m_head(head), m_head_len(head_len) {}
+
+private:
+    friend IOAwaitable;
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_sendfile(m_file_fd, m_fd, m_offset, m_count, ov, m_head, m_head_len); }
+    int result(int res) const { return res; }
+
+    sys::os_fd_t m_file_fd;
+    size_t m_offset;
+    size_t m_count;
+    const void* m_head;
+    size_t m_head_len;
+};
+
+struct RecvFromResult {
+    int result = 0; // Bytes received or -errno
+    sockaddr_storage peer{};
+    int peer_len = 0;
+};
+
+// One datagram and its sender. Linux goes through recvmsg, since a plain
+// io_uring recv does not report the address.
+class RecvFromAwaitable : public detail::IOAwaitable<RecvFromAwaitable> {
+public:
+    RecvFromAwaitable(core::Ring& ring, sys::native_handle_t fd, void* buf, size_t len)
+        : IOAwaitable(ring, fd), m_buf(buf), m_len(len) {}
+
+private:
+    friend IOAwaitable;
+
+#ifdef PLATFORM_WINDOWS
+    void submit(sys::NativeOverlapped* ov) {
+        m_peer_len = sizeof(m_peer);
+        m_ring.submit_recvfrom(m_fd, m_buf, m_len, (sockaddr*)&m_peer, &m_peer_len, ov);
+    }
+#else
+    void submit(sys::NativeOverlapped* ov) {
+        m_iov = sys::make_iovec(m_buf, m_len);
+        m_msg = {};
+        m_msg.msg_name = &m_peer;
+        m_msg.msg_namelen = sizeof(m_peer);
+        m_msg.msg_iov = &m_iov;
+        m_msg.msg_iovlen = 1;
+        m_ring.submit_recvmsg(m_fd, &m_msg, ov);
     }
+#endif
 
-    int await_resume() {
-        return ov->result;
+    RecvFromResult result(int res) const {
+        RecvFromResult r;
+        r.result = res;
+        if (res >= 0) {
+            r.peer = m_peer;
+#ifdef PLATFORM_WINDOWS
+            r.peer_len = m_peer_len;
+#else
+            r.peer_len = static_cast<int>(m_msg.msg_namelen);
+#endif
+        }
+        return r;
     }
+
+    void* m_buf;
+    size_t m_len;
+    sockaddr_storage m_peer;
+#ifdef PLATFORM_WINDOWS
+    int m_peer_len = 0;
+#else
+    sys::IoVec m_iov;
+    sys::MsgHdr m_msg;
+#endif
 };
 
+// Bytes received or -errno; `msg` must outlive the co_await
+class RecvMsgAwaitable : public detail::IOAwaitable<RecvMsgAwaitable> {
+public:
+    RecvMsgAwaitable(core::Ring& ring, sys::native_handle_t fd, sys::MsgHdr& msg) : IOAwaitable(ring, fd), m_msg(msg) {}
+
+private:
+    friend IOAwaitable;
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_recvmsg(m_fd, &m_msg, ov); }
+    int result(int res) const { return res; }
+
+    sys::MsgHdr& m_msg;
+};
+
+// Bytes sent or -errno; `msg` must outlive the co_await
+class SendMsgAwaitable : public detail::IOAwaitable<SendMsgAwaitable> {
+public:
+    SendMsgAwaitable(core::Ring& ring, sys::native_handle_t fd, const sys::MsgHdr& msg) : IOAwaitable(ring, fd), m_msg(msg) {}
+
+private:
+    friend IOAwaitable;
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_sendmsg(m_fd, &m_msg, ov); }
+    int result(int res) const { return res; }
+
+    const sys::MsgHdr& m_msg;
+};
+
+// Cancels `target` (an operation in flight on `fd`). Yields 0 if it was found,
+// -ENOENT or -EALREADY otherwise; IOCP cancels synchronously and always yields 0.
+class CancelAwaitable : public detail::IOAwaitable<CancelAwaitable> {
+public:
+    CancelAwaitable(core::Ring& ring, sys::native_handle_t fd, sys::NativeOverlapped* target) : IOAwaitable(ring, fd), m_target(target) {}
+
+#ifdef PLATFORM_WINDOWS
+    bool await_ready() {
+        m_ring.submit_cancel(m_fd, m_target);
+        return true;
+    }
+#endif
+
+private:
+    friend IOAwaitable;
+    void submit(sys::NativeOverlapped* ov) { m_ring.submit_cancel(m_fd, m_target, ov); }
+#ifdef PLATFORM_WINDOWS
+    int result(int) const { return 0; }
+#else
+    int result(int res) const { return res; }
+#endif
+
+    sys::NativeOverlapped* m_target;
+};
+
+// Gathered writes are WritevAwaitable/ChainWriteAwaitable (Writev.hpp) and
+// timeouts core::Ring::sleep(); both already carry their own completion state.
+
 }
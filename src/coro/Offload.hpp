@@ -0,0 +1,78 @@
+#pragma once
+#include "../core/Ring.hpp"
+#include "../core/WorkerPool.hpp"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace coro {
+
+// `co_await offload(pool, fn)` runs `fn` on a worker thread and resumes the
+// coroutine back on the ring it was running on, through that ring's inbox.
+// Yields what `fn` returns; an exception thrown by `fn` is rethrown in the
+// coroutine. Anything `fn` captures by reference must outlive the co_await,
+// which it does for locals of the awaiting coroutine.
+template <typename Fn>
+class OffloadAwaitable : core::WorkerPool::Job {
+    using Result = std::invoke_result_t<Fn&>;
+    using Stored = std::conditional_t<std::is_void_v<Result>, std::monostate, Result>;
+
+public:
+    OffloadAwaitable(core::WorkerPool& pool, Fn fn) : m_pool(pool), m_fn(std::move(fn)) {
+        run = &OffloadAwaitable::execute;
+    }
+
+    OffloadAwaitable(const OffloadAwaitable&) = delete;
+    OffloadAwaitable& operator=(const OffloadAwaitable&) = delete;
+
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        m_resume.waiter = h;
+        m_home = core::Ring::current();
+        m_pool.submit(this);
+    }
+
+    Result await_resume() {
+        if (m_exception) std::rethrow_exception(m_exception);
+        if constexpr (!std::is_void_v<Result>) return std::move(*m_result);
+    }
+
+private:
+    static void execute(core::WorkerPool::Job* job) {
+        OffloadAwaitable* self = static_cast<OffloadAwaitable*>(job);
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                self->m_fn();
+                self->m_result.emplace();
+            } else {
+                self->m_result.emplace(self->m_fn());
+            }
+        } catch (...) {
+            self->m_exception = std::current_exception();
+        }
+
+        if (self->m_home) {
+            self->m_home->post(&self->m_resume);
+        } else {
+            self->m_resume.waiter.resume(); // Not awaited from a ring: carry on on the worker
+        }
+    }
+
+    core::WorkerPool& m_pool;
+    Fn m_fn;
+    core::Ring* m_home = nullptr;
+    core::Ring::ResumeMessage m_resume;
+    std::optional<Stored> m_result;
+    std::exception_ptr m_exception;
+};
+
+template <typename Fn>
+OffloadAwaitable<Fn> offload(core::WorkerPool& pool, Fn fn) {
+    return OffloadAwaitable<Fn>(pool, std::move(fn));
+}
+
+}
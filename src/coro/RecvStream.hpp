@@ -0,0 +1,292 @@
+#pragma once
+#include "Cancellation.hpp"
+#include "../core/Ring.hpp"
+#include "../core/BufferPool.hpp"
+#include "../sys/Platform.hpp"
+#include <coroutine>
+#include <deque>
+#include <utility>
+#include <cerrno>
+
+namespace coro {
+
+// Receive side of a connection. When the ring has a provided-buffer ring, one
+// multishot recv stays armed and the kernel picks a pool block only when data
+// actually arrives, so idle connections hold no buffer. Otherwise (Windows, or
+// the buffer ring ran dry with ENOBUFS) it falls back to plain reads into a
+// block taken from the pool. Data that arrives while the consumer is busy is
+// detached from the buffer ring, whose slot gets a fresh pool block, so a
+// queued chunk holds no provided buffer. At most MAX_READY_CHUNKS queue up;
+// then the multishot recv is cancelled and re-armed by the next wait.
+class RecvStream {
+    static constexpr int DETACHED = -2;
+
+    struct Chunk {
+        int result = 0; // Bytes received, 0 on EOF, -errno on failure
+        char* data = nullptr;
+        int bid = -1;   // Provided buffer id, -1 for the fallback block, DETACHED for a pool block of its own
+    };
+
+public:
+    static constexpr size_t MAX_READY_CHUNKS = 8;
+
+    // Received bytes, valid until the lease is destroyed. In fallback mode only
+    // one lease may be alive at a time.
+    class Lease {
+    public:
+        Lease() = default;
+        Lease(RecvStream* stream, Chunk chunk) : m_stream(stream), m_chunk(chunk) {}
+        Lease(Lease&& other) noexcept : m_stream(other.m_stream), m_chunk(other.m_chunk) { other.m_stream = nullptr; }
+        Lease& operator=(Lease&& other) noexcept {
+            if (this != &other) {
+                reset();
+                m_stream = other.m_stream;
+                m_chunk = other.m_chunk;
+                other.m_stream = nullptr;
+            }
+            return *this;
+        }
+        ~Lease() { reset(); }
+
+        int result() const { return m_chunk.result; }
+        const char* data() const { return m_chunk.data; }
+
+        void reset() {
+            if (m_stream) {
+                m_stream->release(m_chunk);
+                m_stream = nullptr;
+            }
+        }
+
+    private:
+        RecvStream* m_stream = nullptr;
+        Chunk m_chunk;
+    };
+
+    RecvStream(core::Ring& ring, core::BufferPool& pool, sys::native_handle_t fd)
+        : m_ring(ring), m_pool(pool), m_fd(fd) {
+#ifdef PLATFORM_LINUX
+        m_provided = ring.has_buffer_ring();
+        m_recv_ov.user_data = this;
+        m_recv_ov.on_complete = &RecvStream::on_multishot;
+#endif
+        m_read_ov.user_data = this;
+        m_read_ov.on_complete = &RecvStream::on_read;
+    }
+
+    RecvStream(const RecvStream&) = delete;
+    RecvStream& operator=(const RecvStream&) = delete;
+
+    ~RecvStream() {
+        for (const Chunk& c : m_ready) release(c);
+        if (m_block) m_pool.deallocate(m_block);
+    }
+
+    struct NextAwaitable {
+        RecvStream& stream;
+        uint64_t timeout_ms;
+        CancellationToken token;
+        core::Timer deadline;
+        CancellationRegistration cancel;
+
+        bool await_ready() {
+            if (stream.m_ready.empty() && token.cancelled()) {
+                stream.m_ready.push_back(Chunk{ -ECANCELED, nullptr, -1 });
+            }
+            return !stream.m_ready.empty();
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            stream.m_expired = false;
+            if (!stream.start()) return false;
+            stream.m_waiter = h;
+            if (timeout_ms > 0) {
+                deadline.user_data = &stream;
+                deadline.on_expire = &RecvStream::on_deadline;
+                stream.m_ring.add_timer(deadline, timeout_ms);
+            }
+            if (token.can_be_cancelled()) cancel.attach(token, &RecvStream::on_cancel, &stream);
+            return true;
+        }
+
+        Lease await_resume() {
+            stream.m_ring.cancel_timer(deadline);
+            cancel.reset();
+            Chunk c = stream.m_ready.front();
+            stream.m_ready.pop_front();
+            return Lease(&stream, c);
+        }
+    };
+
+    // With a timeout, or once `token` is cancelled, a receive still pending is
+    // cancelled and the lease carries -ECANCELED (0 on Windows).
+    NextAwaitable next(uint64_t timeout_ms = 0, CancellationToken token = {}) {
+        return NextAwaitable{ *this, timeout_ms, std::move(token), {}, {} };
+    }
+
+    // Must be awaited before the stream is destroyed: a multishot recv keeps
+    // referencing the stream until the kernel posts its final completion.
+    struct StopAwaitable {
+        RecvStream& stream;
+
+        bool await_ready() const { return !stream.m_armed; }
+
+        void await_suspend(std::coroutine_handle<> h) {
+            stream.m_stopper = h;
+#ifdef PLATFORM_LINUX
+            stream.m_ring.submit_cancel(stream.m_fd, &stream.m_recv_ov);
+#endif
+        }
+
+        void await_resume() {}
+    };
+
+    StopAwaitable stop() { return StopAwaitable{*this}; }
+
+private:
+    // Issues the next receive. Returns false if a result was queued synchronously.
+    bool start() {
+#ifdef PLATFORM_LINUX
+        if (m_provided && !m_nobufs) {
+            if (!m_armed) {
+                m_armed = true;
+                m_ring.submit_recv_multishot(m_fd, &m_recv_ov);
+            }
+            return true;
+        }
+        m_nobufs = false; // Try the buffer ring again after this read
+#endif
+        if (!m_block) m_block = m_pool.allocate();
+        if (!m_block) {
+            m_ready.push_back(Chunk{ -ENOBUFS, nullptr, -1 });
+            return false;
+        }
+        m_ring.submit_read(m_fd, m_block, core::BufferPool::BLOCK_SIZE, &m_read_ov);
+        return true;
+    }
+
+    void release(const Chunk& c) {
+#ifdef PLATFORM_LINUX
+        if (c.bid >= 0) {
+            m_ring.recycle_buffer(static_cast<uint16_t>(c.bid));
+            return;
+        }
+        if (c.bid == DETACHED) {
+            m_pool.deallocate(c.data);
+            return;
+        }
+#endif
+        // The fallback block stays pinned only when there is no buffer ring to return to
+        if (c.data && m_provided && m_block) {
+            m_pool.deallocate(m_block);
+            m_block = nullptr;
+        }
+    }
+
+    void wake() {
+        if (m_waiter && !m_ready.empty()) {
+            std::coroutine_handle<> waiter = m_waiter;
+            m_waiter = nullptr;
+            waiter.resume();
+        }
+    }
+
+    static void on_deadline(core::Timer* t) {
+        static_cast<RecvStream*>(t->user_data)->cancel_wait();
+    }
+
+    static void on_cancel(void* ctx) {
+        static_cast<RecvStream*>(ctx)->cancel_wait();
+    }
+
+    void cancel_wait() {
+        if (m_expired) return; // Deadline and token both fired
+        m_expired = true;
+#ifdef PLATFORM_LINUX
+        if (m_armed) {
+            m_ring.submit_cancel(m_fd, &m_recv_ov);
+            return;
+        }
+#endif
+        m_ring.submit_cancel(m_fd, &m_read_ov);
+    }
+
+    static void on_read(sys::NativeOverlapped* ov, int result, uint32_t) {
+        RecvStream* self = static_cast<RecvStream*>(ov->user_data);
+        self->m_ready.push_back(Chunk{ result, result > 0 ? static_cast<char*>(self->m_block) : nullptr, -1 });
+        self->wake();
+    }
+
+#ifdef PLATFORM_LINUX
+    static void on_multishot(sys::NativeOverlapped* ov, int result, uint32_t flags) {
+        RecvStream* self = static_cast<RecvStream*>(ov->user_data);
+        if (!(flags & IORING_CQE_F_MORE)) {
+            self->m_armed = false;
+            self->m_paused = false;
+        }
+
+        if (flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+            if (self->m_stopper) {
+                self->m_ring.recycle_buffer(bid);
+            } else if (self->m_waiter) {
+                self->m_ready.push_back(Chunk{ result, static_cast<char*>(self->m_ring.provided_buffer(bid)), bid });
+            } else {
+                // Nobody is reading: keep the bytes, and give the kernel a fresh block in their place
+                self->m_ready.push_back(Chunk{ result, static_cast<char*>(self->m_ring.detach_buffer(bid)), DETACHED });
+                if (self->m_armed && !self->m_paused && self->m_ready.size() >= MAX_READY_CHUNKS) {
+                    // Backpressure: the final completion disarms, and the next wait re-arms
+                    self->m_paused = true;
+                    self->m_ring.submit_cancel(self->m_fd, &self->m_recv_ov);
+                }
+            }
+        } else if (result == -ENOBUFS) {
+            // Every provided buffer is in use: serve this connection from the pool
+            // directly, and refill slots a detach left empty while the pool was dry
+            self->m_nobufs = true;
+            self->m_ring.replenish_buffers();
+        } else if (result == -ECANCELED && !self->m_expired && !self->m_stopper) {
+            // The backpressure cancel, or a deadline cancel that lost the race
+            // against data: the consumer already has data, so just re-arm below
+        } else if (!self->m_stopper) {
+            self->m_ready.push_back(Chunk{ result, nullptr, -1 });
+        }
+
+        if (self->m_stopper) {
+            if (!self->m_armed) {
+                std::coroutine_handle<> stopper = self->m_stopper;
+                self->m_stopper = nullptr;
+                stopper.resume();
+            }
+            return;
+        }
+
+        if (self->m_waiter && self->m_ready.empty() && !self->m_armed) {
+            self->start(); // Re-arm, or fall back to a plain read after ENOBUFS
+        }
+        self->wake();
+    }
+#endif
+
+    core::Ring& m_ring;
+    core::BufferPool& m_pool;
+    sys::native_handle_t m_fd;
+    bool m_provided = false;
+    bool m_armed = false;
+    bool m_expired = false; // The current wait was cancelled (deadline or token)
+
+    sys::NativeOverlapped m_read_ov;
+    void* m_block = nullptr;
+
+#ifdef PLATFORM_LINUX
+    sys::NativeOverlapped m_recv_ov;
+    bool m_nobufs = false;
+    bool m_paused = false; // Multishot cancelled because MAX_READY_CHUNKS are queued
+#endif
+
+    std::deque<Chunk> m_ready;
+    std::coroutine_handle<> m_waiter;
+    std::coroutine_handle<> m_stopper;
+};
+
+}
@@ -0,0 +1,154 @@
+#pragma once
+#include "../core/Ring.hpp"
+#include "../core/IOBuf.hpp"
+#include "../sys/Platform.hpp"
+#include <array>
+#include <coroutine>
+#include <utility>
+#include <vector>
+#include <cerrno>
+
+namespace coro {
+
+// In-flight zero-copy send. It owns the payload chain and outlives the
+// awaiting coroutine if needed: the sender resumes once every byte is accepted
+// (or the send fails), but the chain is only released after the kernel has
+// posted a notification for every send it issued. Up to MAX_IOV slices go out
+// per sendmsg; a send that would carry less than `threshold` bytes is copied,
+// since pinning pages costs more than copying them below that.
+class ZcSend {
+public:
+    static constexpr unsigned MAX_IOV = 64;
+
+    ZcSend(core::Ring& ring, sys::native_handle_t fd, core::IOBuf&& payload, size_t threshold)
+        : m_ring(ring), m_fd(fd), m_payload(std::move(payload)), m_len(m_payload.size()), m_threshold(threshold) {
+        m_ov.user_data = this;
+        m_ov.on_complete = &ZcSend::on_complete;
+    }
+
+    ZcSend(const ZcSend&) = delete;
+    ZcSend& operator=(const ZcSend&) = delete;
+
+    size_t size() const { return m_len; }
+    int result() const { return m_result; }
+
+    void start(std::coroutine_handle<> waiter) {
+        m_waiter = waiter;
+        send_next();
+    }
+
+private:
+    void send_next() {
+        unsigned count = m_payload.iovecs(m_iov.data(), MAX_IOV);
+        size_t bytes = 0;
+        for (unsigned i = 0; i < count; ++i) bytes += sys::iovec_size(m_iov[i]);
+
+        m_zero_copy = !m_copy && bytes >= m_threshold;
+        if (m_zero_copy) {
+            m_ring.submit_sendmsg_zc(m_fd, m_iov.data(), count, &m_msg, &m_ov);
+        } else {
+            m_ring.submit_writev(m_fd, m_iov.data(), count, &m_msg, &m_ov);
+        }
+    }
+
+    static void on_complete(sys::NativeOverlapped* ov, int result, uint32_t flags) {
+        ZcSend* self = static_cast<ZcSend*>(ov->user_data);
+#ifdef PLATFORM_LINUX
+        if (flags & IORING_CQE_F_NOTIF) {
+            self->m_notifications--;
+            self->finish();
+            return;
+        }
+        if (flags & IORING_CQE_F_MORE) {
+            self->m_notifications++;
+        }
+#else
+        (void)flags;
+#endif
+
+        if ((result == -EOPNOTSUPP || result == -EINVAL) && self->m_zero_copy && self->m_sent == 0) {
+            // Socket or kernel without zero-copy support: fall back to ordinary sends
+            self->m_copy = true;
+            self->send_next();
+            return;
+        }
+
+        if (result > 0) {
+            self->m_sent += result;
+            // Sent bytes may still be referenced by the kernel: set them aside
+            // rather than releasing them
+            self->m_retired.push_back(self->m_payload.split(result));
+            if (!self->m_payload.empty()) {
+                self->send_next();
+                return;
+            }
+            self->m_result = static_cast<int>(self->m_sent);
+        } else {
+            self->m_result = result;
+        }
+
+        std::coroutine_handle<> waiter = self->m_waiter;
+        self->m_waiter = nullptr;
+        self->m_done = true;
+        waiter.resume();
+        self->finish();
+    }
+
+    void finish() {
+        if (m_done && m_notifications == 0) delete this;
+    }
+
+    core::Ring& m_ring;
+    sys::native_handle_t m_fd;
+    sys::NativeOverlapped m_ov;
+
+    core::IOBuf m_payload;              // Not sent yet
+    std::vector<core::IOBuf> m_retired; // Sent, kept until the notifications are in
+    size_t m_len;
+    size_t m_threshold;
+    std::array<sys::IoVec, MAX_IOV> m_iov{};
+    sys::MsgHdr m_msg{};
+    size_t m_sent = 0;
+    int m_result = 0;
+    unsigned m_notifications = 0; // Sends whose F_NOTIF is still outstanding
+    bool m_zero_copy = false;     // The send in flight
+    bool m_copy = false;          // Zero-copy is unsupported here
+    bool m_done = false;
+    std::coroutine_handle<> m_waiter;
+};
+
+// `co_await SendZcAwaitable(ring, fd, std::move(chain), threshold)` sends the
+// whole chain and yields the bytes sent or -errno. An empty chain completes
+// at once with 0.
+class SendZcAwaitable {
+public:
+    SendZcAwaitable(core::Ring& ring, sys::native_handle_t fd, core::IOBuf&& payload, size_t threshold = 0)
+        : m_op(payload.empty() ? nullptr : new ZcSend(ring, fd, std::move(payload), threshold)) {}
+
+    SendZcAwaitable(SendZcAwaitable&& other) noexcept
+        : m_op(std::exchange(other.m_op, nullptr)), m_started(other.m_started) {}
+
+    SendZcAwaitable(const SendZcAwaitable&) = delete;
+    SendZcAwaitable& operator=(const SendZcAwaitable&) = delete;
+
+    // Once started, the op frees itself after its notifications are in
+    ~SendZcAwaitable() {
+        if (!m_started) delete m_op;
+    }
+
+    bool await_ready() const { return m_op == nullptr; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        m_started = true;
+        m_op->start(h);
+    }
+
+    // Reads the op before control returns to the ring, which may free it
+    int await_resume() const { return m_op ? m_op->result() : 0; }
+
+private:
+    ZcSend* m_op;
+    bool m_started = false;
+};
+
+}
@@ -1,17 +1,151 @@
 #pragma once
+#include "FrameAllocator.hpp"
 #include <coroutine>
 #include <exception>
+#include <optional>
+#include <utility>
 
 namespace coro {
 
-struct Task {
-    struct promise_type {
-        Task get_return_object() { return {}; }
-        std::suspend_never initial_suspend() { return {}; }
-        std::suspend_never final_suspend() noexcept { return {}; }
-        void return_void() {}
-        void unhandled_exception() { std::terminate(); }
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+    bool detached = false;
+
+    // Finishing resumes the awaiter directly (symmetric transfer), so long
+    // chains of sub-tasks completing synchronously don't grow the stack
+    struct FinalAwaiter {
+        bool await_ready() const noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            PromiseBase& p = h.promise();
+            if (p.detached) {
+                // Nobody to hand an exception to
+                if (p.exception) std::terminate();
+                h.destroy();
+                return std::noop_coroutine();
+            }
+            return p.continuation ? p.continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
     };
+
+    // Frames come from the thread's free lists rather than the global heap
+    static void* operator new(size_t size) { return FrameAllocator::allocate(size); }
+    static void operator delete(void* ptr) noexcept { FrameAllocator::deallocate(ptr); }
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    template <typename U>
+    void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+    T result() {
+        if (exception) std::rethrow_exception(exception);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result() {
+        if (exception) std::rethrow_exception(exception);
+    }
 };
 
 }
+
+// Lazily started coroutine. Nothing runs until the task is awaited (or
+// handed to spawn()); the awaiter then gets the result, or the exception the
+// task exited with.
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+    using handle_type = std::coroutine_handle<promise_type>;
+
+    Task() = default;
+    explicit Task(handle_type h) : m_handle(h) {}
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (m_handle) m_handle.destroy();
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (m_handle) m_handle.destroy();
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    struct Awaiter {
+        handle_type handle;
+
+        bool await_ready() const noexcept { return handle.done(); }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+            handle.promise().continuation = awaiting;
+            return handle; // Start the task in place of the awaiter
+        }
+
+        T await_resume() { return handle.promise().result(); }
+    };
+
+    // The task must hold a coroutine: awaiting an empty (default-constructed,
+    // moved-from or released) Task is a precondition violation
+    Awaiter operator co_await() const& noexcept { return Awaiter{ m_handle }; }
+
+    // Gives up ownership: the task destroys itself when it finishes
+    handle_type release() noexcept { return std::exchange(m_handle, nullptr); }
+
+private:
+    handle_type m_handle;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+}
+
+// Starts a top-level task that nobody awaits. It runs until its first
+// suspension right away and frees itself when done; an exception escaping it
+// terminates the process, so it should handle its own errors.
+template <typename T>
+void spawn(Task<T> task) {
+    auto h = task.release();
+    if (!h) return;
+    h.promise().detached = true;
+    h.resume();
+}
+
+}
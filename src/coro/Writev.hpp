@@ -0,0 +1,148 @@
+#pragma once
+#include "../core/Ring.hpp"
+#include "../core/IOBuf.hpp"
+#include "../sys/Platform.hpp"
+#include <array>
+#include <coroutine>
+
+namespace coro {
+
+// Gathered write of up to MAX_IOV segments. Short writes are resubmitted from
+// the segment and offset where the previous one stopped, so the awaiting
+// coroutine resumes once with the total written or the first error. The
+// segments' memory must outlive the co_await.
+class WritevAwaitable {
+public:
+    static constexpr unsigned MAX_IOV = 8;
+
+    template <typename... Segments>
+    WritevAwaitable(core::Ring& ring, sys::native_handle_t fd, const Segments&... segments)
+        : m_ring(ring), m_fd(fd) {
+        static_assert(sizeof...(Segments) <= MAX_IOV, "too many segments");
+        (add(segments), ...);
+    }
+
+    WritevAwaitable(const WritevAwaitable&) = delete;
+    WritevAwaitable& operator=(const WritevAwaitable&) = delete;
+
+    bool await_ready() const { return m_count == 0; }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        m_waiter = h;
+        m_ov.user_data = this;
+        m_ov.on_complete = &WritevAwaitable::on_complete;
+        m_ring.submit_writev(m_fd, m_iov.data(), m_count, &m_msg, &m_ov);
+    }
+
+    int await_resume() const { return m_result; }
+
+private:
+    void add(const sys::IoVec& v) {
+        if (sys::iovec_size(v) > 0) m_iov[m_count++] = v;
+    }
+
+    static void on_complete(sys::NativeOverlapped* ov, int result, uint32_t) {
+        WritevAwaitable* self = static_cast<WritevAwaitable*>(ov->user_data);
+        if (result <= 0) {
+            self->m_result = result;
+            self->m_waiter.resume();
+            return;
+        }
+
+        self->m_sent += result;
+        size_t n = result;
+        while (n > 0) {
+            sys::IoVec& v = self->m_iov[self->m_first];
+            size_t len = sys::iovec_size(v);
+            if (n < len) {
+                v = sys::make_iovec(sys::iovec_data(v) + n, len - n);
+                break;
+            }
+            n -= len;
+            self->m_first++;
+        }
+
+        if (self->m_first < self->m_count) {
+            self->m_ring.submit_writev(self->m_fd, self->m_iov.data() + self->m_first, self->m_count - self->m_first, &self->m_msg, &self->m_ov);
+            return;
+        }
+
+        self->m_result = static_cast<int>(self->m_sent);
+        self->m_waiter.resume();
+    }
+
+    core::Ring& m_ring;
+    sys::native_handle_t m_fd;
+    sys::NativeOverlapped m_ov;
+
+    std::array<sys::IoVec, MAX_IOV> m_iov{};
+    sys::MsgHdr m_msg{};
+    unsigned m_count = 0;
+    unsigned m_first = 0; // First segment not fully written
+    size_t m_sent = 0;
+    int m_result = 0;
+    std::coroutine_handle<> m_waiter;
+};
+
+// Writes a whole chain, up to MAX_IOV slices per writev, consuming it as it
+// goes. Resumes with the total written or the first error; whatever was not
+// written stays in the chain.
+class ChainWriteAwaitable {
+public:
+    static constexpr unsigned MAX_IOV = 16;
+
+    ChainWriteAwaitable(core::Ring& ring, sys::native_handle_t fd, core::IOBuf& chain)
+        : m_ring(ring), m_fd(fd), m_chain(chain) {}
+
+    ChainWriteAwaitable(const ChainWriteAwaitable&) = delete;
+    ChainWriteAwaitable& operator=(const ChainWriteAwaitable&) = delete;
+
+    bool await_ready() const { return m_chain.empty(); }
+
+    void await_suspend(std::coroutine_handle<> h) {
+        m_waiter = h;
+        m_ov.user_data = this;
+        m_ov.on_complete = &ChainWriteAwaitable::on_complete;
+        submit();
+    }
+
+    int await_resume() const { return m_result; }
+
+private:
+    void submit() {
+        unsigned count = m_chain.iovecs(m_iov.data(), MAX_IOV);
+        m_ring.submit_writev(m_fd, m_iov.data(), count, &m_msg, &m_ov);
+    }
+
+    static void on_complete(sys::NativeOverlapped* ov, int result, uint32_t) {
+        ChainWriteAwaitable* self = static_cast<ChainWriteAwaitable*>(ov->user_data);
+        if (result <= 0) {
+            self->m_result = result;
+            self->m_waiter.resume();
+            return;
+        }
+
+        self->m_sent += result;
+        self->m_chain.trim_front(result);
+        if (!self->m_chain.empty()) {
+            self->submit();
+            return;
+        }
+
+        self->m_result = static_cast<int>(self->m_sent);
+        self->m_waiter.resume();
+    }
+
+    core::Ring& m_ring;
+    sys::native_handle_t m_fd;
+    core::IOBuf& m_chain;
+    sys::NativeOverlapped m_ov;
+
+    std::array<sys::IoVec, MAX_IOV> m_iov{};
+    sys::MsgHdr m_msg{};
+    size_t m_sent = 0;
+    int m_result = 0;
+    std::coroutine_handle<> m_waiter;
+};
+
+}
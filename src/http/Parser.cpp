@@ -1,5 +1,7 @@
 #include "Parser.hpp"
-#include <cctype>
+#include "Scan.hpp"
+#include <algorithm>
+#include <cstring>
 
 namespace http {
 
@@ -10,155 +12,470 @@ Parser::Parser() {
 void Parser::reset() {
     m_state = State::METHOD_START;
     m_req.reset();
-    m_ptr_start = nullptr;
+    m_pos = 0;
+    m_mark = 0;
+    m_uri = {};
+    m_field_count = 0;
+    m_chunked = false;
+    m_has_length = false;
+    m_expect_continue = false;
+    m_content_length = 0;
+    m_body_state = BodyState::LENGTH;
+    m_body_left = 0;
+    m_chunk_digits = 0;
+    m_pieces.clear();
+}
+
+namespace {
+
+bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((a[i] | 0x20) != (b[i] | 0x20)) return false; // `b` is lowercase letters, digits and '-'
+    }
+    return true;
+}
+
+// Trailing whitespace; the parser skips the leading kind
+std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// Lowercase names of the KnownHeader values, in order
+constexpr std::array<std::string_view, Request::KNOWN_HEADERS> KNOWN_NAMES = {
+    "host", "connection", "content-length", "content-type", "transfer-encoding",
+    "accept", "accept-encoding", "accept-language", "user-agent", "cookie", "authorization",
+    "cache-control", "expect", "upgrade", "origin", "referer", "range", "if-none-match", "if-modified-since",
+};
+
+// Perfect hash over KNOWN_NAMES keyed on the length and the case-folded first
+// and last characters, with a multiplier searched for at compile time. A hit
+// still has to match the whole name.
+constexpr size_t KNOWN_SLOT_BITS = 6;
+
+constexpr uint32_t known_key(std::string_view name) {
+    return static_cast<uint32_t>(name.size()) << 16
+         | static_cast<uint32_t>(static_cast<uint8_t>(name.front() | 0x20)) << 8
+         | static_cast<uint8_t>(name.back() | 0x20);
+}
+
+constexpr size_t known_slot(uint32_t key, uint32_t seed) { return (key * seed) >> (32 - KNOWN_SLOT_BITS); }
+
+constexpr uint32_t KNOWN_SEED = [] {
+    for (uint32_t seed = 0x9E3779B1u; seed < 0x9E3779B1u + 2 * 100000; seed += 2) {
+        std::array<bool, size_t{1} << KNOWN_SLOT_BITS> used{};
+        bool distinct = true;
+        for (std::string_view name : KNOWN_NAMES) {
+            size_t slot = known_slot(known_key(name), seed);
+            if (used[slot]) {
+                distinct = false;
+                break;
+            }
+            used[slot] = true;
+        }
+        if (distinct) return seed;
+    }
+    return 0u;
+}();
+static_assert(KNOWN_SEED != 0, "no collision-free seed for KNOWN_NAMES");
+
+constexpr std::array<uint8_t, size_t{1} << KNOWN_SLOT_BITS> KNOWN_TABLE = [] {
+    std::array<uint8_t, size_t{1} << KNOWN_SLOT_BITS> table{};
+    table.fill(static_cast<uint8_t>(KnownHeader::Count));
+    for (size_t i = 0; i < KNOWN_NAMES.size(); ++i) table[known_slot(known_key(KNOWN_NAMES[i]), KNOWN_SEED)] = static_cast<uint8_t>(i);
+    return table;
+}();
+
+static_assert(std::ranges::all_of(KNOWN_NAMES, [](std::string_view name) { return name.size() >= 4; }));
+
+template <typename T>
+T load(const char* p) {
+    T v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+// iequals() a word at a time, with the last word overlapping the one before
+// it. `name` is as long as `lower`, which is at least 4 bytes.
+bool equals_known(std::string_view name, std::string_view lower) {
+    size_t n = name.size();
+    if (n < 8) {
+        constexpr uint32_t FOLD = 0x20202020;
+        return (load<uint32_t>(name.data()) | FOLD) == load<uint32_t>(lower.data())
+            && (load<uint32_t>(name.data() + n - 4) | FOLD) == load<uint32_t>(lower.data() + n - 4);
+    }
+    constexpr uint64_t FOLD = 0x2020202020202020;
+    for (size_t i = 0; i + 8 < n; i += 8) {
+        if ((load<uint64_t>(name.data() + i) | FOLD) != load<uint64_t>(lower.data() + i)) return false;
+    }
+    return (load<uint64_t>(name.data() + n - 8) | FOLD) == load<uint64_t>(lower.data() + n - 8);
+}
+
+// KnownHeader::Count for a name we don't index. `name` is a non-empty token.
+KnownHeader classify(std::string_view name) {
+    uint8_t i = KNOWN_TABLE[known_slot(known_key(name), KNOWN_SEED)];
+    if (i == static_cast<uint8_t>(KnownHeader::Count)) return KnownHeader::Count;
+    std::string_view known = KNOWN_NAMES[i];
+    if (name.size() != known.size() || !equals_known(name, known)) return KnownHeader::Count;
+    return static_cast<KnownHeader>(i);
+}
+
+int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
 }
 
 bool Parser::parse(const char* data, size_t len) {
-    const char* p = data;
+    if (m_state == State::BODY) return parse_body(data, len);
+
+    const char* p = data + m_pos;
     const char* end = data + len;
+    // URI, header name and header value bytes are skipped a vector at a time;
+    // the state machine only sees the byte that ends each of them
+    const scan::Scanner& scanner = scan::scanner();
 
     while (p < end) {
         char c = *p;
-        
+        size_t at = p - data;
+
         switch (m_state) {
             case State::METHOD_START:
-                if (!std::isalpha(c)) return false;
-                m_ptr_start = p;
+                if (!scan::is_token(c)) return fail();
+                m_mark = at;
                 m_state = State::METHOD;
                 break;
-                
+
             case State::METHOD:
                 if (c == ' ') {
-                    std::string_view m(m_ptr_start, p - m_ptr_start);
+                    std::string_view m(data + m_mark, at - m_mark);
                     if (m == "GET") m_req.method = Method::HTTP_GET;
                     else if (m == "POST") m_req.method = Method::HTTP_POST;
                     else m_req.method = Method::HTTP_UNKNOWN;
                     m_state = State::URI_START;
-                } else if (!std::isalpha(c)) {
-                    return false;
+                } else if (!scan::is_token(c)) {
+                    return fail();
                 }
                 break;
-                
+
             case State::URI_START:
-                if (c == ' ') return false; 
-                m_ptr_start = p;
+                if (c == ' ') return fail();
+                m_mark = at;
                 m_state = State::URI;
-                break;
-                
-            case State::URI:
-                if (c == ' ') {
-                    m_req.uri = std::string_view(m_ptr_start, p - m_ptr_start);
-                    m_state = State::VERSION_H;
-                } else if (c == '\r' || c == '\n') {
-                    return false;
+                continue; // Scanned from this byte on
+
+            case State::URI: {
+                const char* stop = scanner.uri_end(p, end);
+                if (stop == end) {
+                    p = end;
+                    continue;
                 }
+                p = stop;
+                if (*p != ' ') return fail();
+                m_uri = span_to(p - data);
+                m_state = State::VERSION_H;
                 break;
-                
-            case State::VERSION_H: if (c == 'H') m_state = State::VERSION_HT; else return false; break;
-            case State::VERSION_HT: if (c == 'T') m_state = State::VERSION_HTT; else return false; break;
-            case State::VERSION_HTT: if (c == 'T') m_state = State::VERSION_HTTP; else return false; break;
-            case State::VERSION_HTTP: if (c == 'P') m_state = State::VERSION_SLASH; else return false; break;
-            case State::VERSION_SLASH: if (c == '/') m_state = State::VERSION_MAJOR; else return false; break;
-            
+            }
+
+            case State::VERSION_H: if (c == 'H') m_state = State::VERSION_HT; else return fail(); break;
+            case State::VERSION_HT: if (c == 'T') m_state = State::VERSION_HTT; else return fail(); break;
+            case State::VERSION_HTT: if (c == 'T') m_state = State::VERSION_HTTP; else return fail(); break;
+            case State::VERSION_HTTP: if (c == 'P') m_state = State::VERSION_SLASH; else return fail(); break;
+            case State::VERSION_SLASH: if (c == '/') m_state = State::VERSION_MAJOR; else return fail(); break;
+
             case State::VERSION_MAJOR:
-                if (std::isdigit(c)) {
+                if (c >= '0' && c <= '9') {
                     m_req.version_major = c - '0';
                     m_state = State::VERSION_DOT;
-                } else return false;
+                } else return fail();
                 break;
-                
+
             case State::VERSION_DOT:
                 if (c == '.') m_state = State::VERSION_MINOR;
-                else return false;
+                else return fail();
                 break;
-                
+
             case State::VERSION_MINOR:
-                if (std::isdigit(c)) {
+                if (c >= '0' && c <= '9') {
                     m_req.version_minor = c - '0';
                     m_state = State::NEWLINE_1;
-                } else return false;
+                } else return fail();
                 break;
-                
+
             case State::NEWLINE_1:
-                if (c == '\r') {} 
+                if (c == '\r') {}
                 else if (c == '\n') m_state = State::HEADER_KEY_START;
-                else return false;
+                else return fail();
                 break;
 
             case State::HEADER_KEY_START:
                 if (c == '\r') {
                     m_state = State::NEWLINE_3;
                 } else if (c == '\n') {
-                    m_state = State::BODY; 
-                    return true; 
-                } else {
-                    m_ptr_start = p;
+                    m_pos = at + 1;
+                    return end_head(data);
+                } else if (scan::is_token(c)) {
+                    m_mark = at;
                     m_state = State::HEADER_KEY;
+                } else {
+                    return fail();
                 }
                 break;
-                
-            case State::HEADER_KEY:
-                if (c == ':') {
-                    if (m_req.header_count < Request::MAX_HEADERS) {
-                        m_req.headers[m_req.header_count].name = std::string_view(m_ptr_start, p - m_ptr_start);
-                    }
-                    m_state = State::HEADER_COLON;
-                } else if (c == '\r' || c == '\n') {
-                    return false;
+
+            case State::HEADER_KEY: {
+                const char* stop = scanner.token_end(p, end);
+                if (stop == end) {
+                    p = end;
+                    continue;
                 }
+                p = stop;
+                if (*p != ':') return fail();
+                m_name = span_to(p - data);
+                if (m_field_count < Request::MAX_HEADERS) m_fields[m_field_count].name = m_name;
+                m_state = State::HEADER_COLON;
                 break;
-                
-            case State::HEADER_COLON:
-                if (c == ' ') m_state = State::HEADER_VALUE_START;
-                else return false; 
-                break;
-                
+            }
+
+            case State::HEADER_COLON: // Optional whitespace before the value
+                if (c == ' ' || c == '\t') break;
+                m_state = State::HEADER_VALUE_START;
+                continue;
+
             case State::HEADER_VALUE_START:
-                m_ptr_start = p;
+                m_mark = at;
                 m_state = State::HEADER_VALUE;
-                break;
-                
-            case State::HEADER_VALUE:
-                if (c == '\r') {
-                    if (m_req.header_count < Request::MAX_HEADERS) {
-                        m_req.headers[m_req.header_count].value = std::string_view(m_ptr_start, p - m_ptr_start);
-                        m_req.header_count++;
-                    }
-                    m_state = State::NEWLINE_2;
-                } else if (c == '\n') {
-                     if (m_req.header_count < Request::MAX_HEADERS) {
-                        m_req.headers[m_req.header_count].value = std::string_view(m_ptr_start, p - m_ptr_start);
-                        m_req.header_count++;
+                continue; // The value may be empty, so this byte is scanned too
+
+            case State::HEADER_VALUE: {
+                const char* stop = scanner.value_end(p, end);
+                if (stop == end) {
+                    p = end;
+                    continue;
+                }
+                p = stop;
+                if (*p == '\r') m_state = State::NEWLINE_2;
+                else if (*p == '\n') m_state = State::HEADER_KEY_START;
+                else return fail();
+                std::string_view value = trim(std::string_view(data + m_mark, p - data - m_mark));
+                KnownHeader known = classify(std::string_view(data + m_name.offset, m_name.len));
+                if (m_field_count < Request::MAX_HEADERS) {
+                    m_fields[m_field_count].value = span_to(m_mark + value.size());
+                    m_field_count++;
+                    if (known != KnownHeader::Count) {
+                        uint8_t& slot = m_req.known[static_cast<size_t>(known)];
+                        if (slot == 0) slot = static_cast<uint8_t>(m_field_count);
                     }
-                    m_state = State::HEADER_KEY_START;
                 }
+                // Headers past MAX_HEADERS are dropped, but still count for framing
+                if (!on_header(known, value)) return fail();
                 break;
-                
+            }
+
             case State::NEWLINE_2:
                 if (c == '\n') m_state = State::HEADER_KEY_START;
-                else return false;
+                else return fail();
                 break;
-                
+
             case State::NEWLINE_3:
                 if (c == '\n') {
-                    m_state = State::BODY;
-                    
-                    m_state = State::COMPLETE;
-                    return true;
+                    m_pos = at + 1;
+                    return end_head(data);
                 }
-                else return false;
+                else return fail();
                 break;
-                
+
             case State::BODY:
             case State::COMPLETE:
                 return true;
-                
+
+            case State::HEADER_SPACE: // Unused
             case State::PARSE_ERROR:
                 return false;
         }
         p++;
     }
+    m_pos = p - data;
+    return true;
+}
+
+bool Parser::on_header(KnownHeader name, std::string_view value) {
+    switch (name) {
+        case KnownHeader::ContentLength: {
+            if (value.empty()) return false;
+            uint64_t length = 0;
+            for (char c : value) {
+                if (c < '0' || c > '9' || length > (UINT64_MAX - 9) / 10) return false;
+                length = length * 10 + (c - '0');
+            }
+            // Repeats must agree, or the two ends could disagree on where the request stops
+            if (m_has_length && length != m_content_length) return false;
+            m_has_length = true;
+            m_content_length = length;
+            break;
+        }
+        case KnownHeader::TransferEncoding:
+            // Chunked is the only coding we decode
+            if (!iequals(value, "chunked")) return false;
+            m_chunked = true;
+            break;
+        case KnownHeader::Expect:
+            m_expect_continue = iequals(value, "100-continue");
+            break;
+        default:
+            break;
+    }
+    return true;
+}
+
+bool Parser::end_head(const char* data) {
+    // Both would let a proxy in front of us frame the request differently
+    if (m_chunked && m_has_length) return fail();
+    fill_request(data);
+    if (m_chunked) {
+        m_state = State::BODY;
+        m_body_state = BodyState::CHUNK_SIZE;
+        m_body_left = 0;
+        m_chunk_digits = 0;
+    } else if (m_content_length > 0) {
+        m_state = State::BODY;
+        m_body_state = BodyState::LENGTH;
+        m_body_left = m_content_length;
+    } else {
+        m_state = State::COMPLETE;
+    }
     return true;
 }
 
+bool Parser::parse_body(const char* data, size_t len) {
+    while (m_pos < len && m_state == State::BODY) {
+        std::string_view piece;
+        m_pos += decode_body(data + m_pos, data + len, piece);
+        if (piece.empty()) continue;
+        uint32_t offset = static_cast<uint32_t>(piece.data() - data);
+        if (!m_pieces.empty() && m_pieces.back().offset + m_pieces.back().len == offset) {
+            m_pieces.back().len += static_cast<uint32_t>(piece.size());
+        } else {
+            m_pieces.push_back(Span{ offset, static_cast<uint32_t>(piece.size()) });
+        }
+    }
+    if (m_state == State::PARSE_ERROR) return false;
+    if (m_state == State::COMPLETE) {
+        fill_request(data);
+        if (m_pieces.size() == 1) {
+            m_req.body = std::string_view(data + m_pieces[0].offset, m_pieces[0].len);
+        } else if (m_pieces.size() > 1) {
+            m_body.clear();
+            for (const Span& s : m_pieces) m_body.append(data + s.offset, s.len);
+            m_req.body = m_body;
+        }
+    }
+    return true;
+}
+
+size_t Parser::read_body(const char* data, size_t len, std::string_view& piece) {
+    piece = {};
+    if (m_state != State::BODY) return 0;
+    return decode_body(data, data + len, piece);
+}
+
+// Consumes framing up to and including at most one run of body bytes, which
+// it returns in `piece`. Stops right after the body ends, so bytes of the
+// next request are left alone.
+size_t Parser::decode_body(const char* begin, const char* end, std::string_view& piece) {
+    const char* p = begin;
+    auto error = [&] {
+        m_state = State::PARSE_ERROR;
+        return static_cast<size_t>(p - begin);
+    };
+    while (p < end) {
+        char c = *p;
+        switch (m_body_state) {
+            case BodyState::LENGTH:
+            case BodyState::CHUNK_DATA: {
+                size_t n = static_cast<size_t>(std::min<uint64_t>(m_body_left, end - p));
+                piece = std::string_view(p, n);
+                m_body_left -= n;
+                if (m_body_left == 0) {
+                    if (m_body_state == BodyState::LENGTH) m_state = State::COMPLETE;
+                    else m_body_state = BodyState::CHUNK_DATA_CR;
+                }
+                return p + n - begin;
+            }
+
+            case BodyState::CHUNK_SIZE: {
+                int digit = hex_digit(c);
+                if (digit >= 0) {
+                    if (m_body_left >> 59) return error();
+                    m_body_left = m_body_left * 16 + digit;
+                    m_chunk_digits++;
+                    break;
+                }
+                if (m_chunk_digits == 0) return error();
+                if (c == ';' || c == ' ' || c == '\t') m_body_state = BodyState::CHUNK_EXT;
+                else if (c == '\r') m_body_state = BodyState::CHUNK_SIZE_LF;
+                else if (c == '\n') m_body_state = m_body_left ? BodyState::CHUNK_DATA : BodyState::TRAILER_START;
+                else return error();
+                break;
+            }
+
+            case BodyState::CHUNK_EXT: // Extensions are ignored
+                if (c == '\r') m_body_state = BodyState::CHUNK_SIZE_LF;
+                else if (c == '\n') m_body_state = m_body_left ? BodyState::CHUNK_DATA : BodyState::TRAILER_START;
+                break;
+
+            case BodyState::CHUNK_SIZE_LF:
+                if (c != '\n') return error();
+                m_body_state = m_body_left ? BodyState::CHUNK_DATA : BodyState::TRAILER_START;
+                break;
+
+            case BodyState::CHUNK_DATA_CR:
+                if (c == '\r') m_body_state = BodyState::CHUNK_DATA_LF;
+                else if (c == '\n') m_body_state = BodyState::CHUNK_SIZE;
+                else return error();
+                m_chunk_digits = 0;
+                break;
+
+            case BodyState::CHUNK_DATA_LF:
+                if (c != '\n') return error();
+                m_body_state = BodyState::CHUNK_SIZE;
+                break;
+
+            case BodyState::TRAILER_START: // Trailer fields are skipped
+                if (c == '\r') {
+                    m_body_state = BodyState::TRAILER_END_LF;
+                } else if (c == '\n') {
+                    m_state = State::COMPLETE;
+                    return p + 1 - begin;
+                } else {
+                    m_body_state = BodyState::TRAILER_LINE;
+                }
+                break;
+
+            case BodyState::TRAILER_LINE:
+                if (c == '\n') m_body_state = BodyState::TRAILER_START;
+                break;
+
+            case BodyState::TRAILER_END_LF:
+                if (c != '\n') return error();
+                m_state = State::COMPLETE;
+                return p + 1 - begin;
+        }
+        p++;
+    }
+    return p - begin;
+}
+
+void Parser::fill_request(const char* data) {
+    auto view = [data](Span s) { return std::string_view(data + s.offset, s.len); };
+    m_req.uri = view(m_uri);
+    for (size_t i = 0; i < m_field_count; ++i) {
+        m_req.headers[i] = Header{ view(m_fields[i].name), view(m_fields[i].value) };
+    }
+    m_req.header_count = m_field_count;
+}
+
 }
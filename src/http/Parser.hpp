@@ -1,6 +1,9 @@
 #pragma once
 #include "Request.hpp"
-#include <span>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
 
 namespace http {
 
@@ -22,21 +25,89 @@ public:
     };
 
     Parser();
-    
+
     void reset();
-    
-    
+
+    // Parses the request that starts at `data`. A request that arrives in
+    // pieces is passed again, from its first byte, with the new bytes after
+    // the old ones; the buffer may have moved in between. Scanning resumes
+    // where the previous call stopped. Returns false on a malformed request.
+    //
+    // Stops after the head: the state is then COMPLETE, or BODY if a body
+    // follows. Calling parse() again in BODY buffers the body, which
+    // request().body holds once COMPLETE (a view into `data` unless chunked
+    // coding split it up). read_body() streams it instead.
     bool parse(const char* data, size_t len);
-    
+
+    // Streams the body in BODY: `data` starts right after what the head or the
+    // previous call consumed. Returns the bytes consumed and sets `piece` to
+    // the body bytes among them (a view into `data`, possibly empty). The
+    // state turns COMPLETE after the last piece, PARSE_ERROR on bad framing.
+    size_t read_body(const char* data, size_t len, std::string_view& piece);
+
+    // The head is filled in at BODY, the body at COMPLETE. The views point
+    // into the last `data` passed to parse().
     const Request& request() const { return m_req; }
     State state() const { return m_state; }
+    // Bytes parse() has taken: the head at BODY, the whole request once COMPLETE
+    size_t consumed() const { return m_pos; }
+
+    // Framing, known from BODY on
+    bool chunked() const { return m_chunked; }
+    uint64_t content_length() const { return m_content_length; }
+    bool expects_continue() const { return m_expect_continue; } // Expect: 100-continue
 
 private:
+    // Positions are kept as offsets from the start of the request until it is
+    // complete, so they survive the caller moving its buffer
+    struct Span {
+        uint32_t offset = 0;
+        uint32_t len = 0;
+    };
+
+    struct Field {
+        Span name;
+        Span value;
+    };
+
+    enum class BodyState {
+        LENGTH,
+        CHUNK_SIZE, CHUNK_EXT, CHUNK_SIZE_LF,
+        CHUNK_DATA, CHUNK_DATA_CR, CHUNK_DATA_LF,
+        TRAILER_START, TRAILER_LINE, TRAILER_END_LF
+    };
+
+    bool fail() {
+        m_state = State::PARSE_ERROR;
+        return false;
+    }
+
+    Span span_to(size_t end) const { return Span{ static_cast<uint32_t>(m_mark), static_cast<uint32_t>(end - m_mark) }; }
+    bool on_header(KnownHeader name, std::string_view value);
+    bool end_head(const char* data);
+    bool parse_body(const char* data, size_t len);
+    size_t decode_body(const char* begin, const char* end, std::string_view& piece);
+    void fill_request(const char* data);
+
     State m_state;
     Request m_req;
-    
-    
-    const char* m_ptr_start;
+
+    size_t m_pos;  // Bytes scanned so far
+    size_t m_mark; // Start of the field being scanned
+    Span m_uri;
+    Span m_name;   // Of the header being parsed
+    std::array<Field, Request::MAX_HEADERS> m_fields;
+    size_t m_field_count;
+
+    bool m_chunked;
+    bool m_has_length;
+    bool m_expect_continue;
+    uint64_t m_content_length;
+    BodyState m_body_state;
+    uint64_t m_body_left;         // Of the Content-Length body or the current chunk; the chunk size while reading it
+    unsigned m_chunk_digits;
+    std::vector<Span> m_pieces;   // Buffered body, adjacent runs merged
+    std::string m_body;           // Buffered body that came in more than one run
 };
 
 }
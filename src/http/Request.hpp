@@ -3,6 +3,7 @@
 #include <optional>
 #include <span>
 #include <array>
+#include <cstdint>
 
 namespace http {
 
@@ -15,6 +16,15 @@ struct Header {
     std::string_view value;
 };
 
+// Headers the parser recognizes by name while parsing, so handlers can look
+// them up without scanning `headers`
+enum class KnownHeader : uint8_t {
+    Host, Connection, ContentLength, ContentType, TransferEncoding,
+    Accept, AcceptEncoding, AcceptLanguage, UserAgent, Cookie, Authorization,
+    CacheControl, Expect, Upgrade, Origin, Referer, Range, IfNoneMatch, IfModifiedSince,
+    Count
+};
+
 struct Request {
     Method method;
     std::string_view uri;
@@ -24,11 +34,24 @@ struct Request {
     static constexpr size_t MAX_HEADERS = 32;
     std::array<Header, MAX_HEADERS> headers;
     size_t header_count = 0;
-    
+
+    // For each KnownHeader, 1 + its index in `headers`, or 0 if absent. The
+    // first of repeated headers wins.
+    static constexpr size_t KNOWN_HEADERS = static_cast<size_t>(KnownHeader::Count);
+    static_assert(MAX_HEADERS < 256);
+    std::array<uint8_t, KNOWN_HEADERS> known{};
+
+    std::optional<std::string_view> header(KnownHeader h) const {
+        uint8_t slot = known[static_cast<size_t>(h)];
+        if (slot == 0) return std::nullopt;
+        return headers[slot - 1].value;
+    }
+
     std::string_view body;
 
     void reset() {
         header_count = 0;
+        known.fill(0);
         body = {};
         uri = {};
     }
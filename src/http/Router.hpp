@@ -3,8 +3,11 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
 #include <unordered_map>
 #include <string_view>
+#include <utility>
+#include <cstdio>
 
 namespace http {
 
@@ -13,37 +16,101 @@ struct Response {
     std::string content_type = "text/plain";
     std::string body;
     
-    std::string to_string() const {
+    // Status line and headers, written separately from the body so the two
+    // can go out in one gathered write. Returns 0 if `cap` is too small.
+    size_t write_head(char* out, size_t cap) const {
+        int n = snprintf(out, cap,
+            "HTTP/1.1 %d OK\r\n"
+            "Content-Type: %s\r\n"
+            "Content-Length: %zu\r\n"
+            "Connection: keep-alive\r\n\r\n",
+            status, content_type.c_str(), body.size());
+        return (n > 0 && static_cast<size_t>(n) < cap) ? static_cast<size_t>(n) : 0;
+    }
+
+    std::string head() const {
         std::string res = "HTTP/1.1 " + std::to_string(status) + " OK\r\n";
         res += "Content-Type: " + content_type + "\r\n";
         res += "Content-Length: " + std::to_string(body.size()) + "\r\n";
         res += "Connection: keep-alive\r\n\r\n";
-        res += body;
         return res;
     }
+
+    std::string to_string() const { return head() + body; }
 };
 
 using Handler = std::function<Response(const Request&)>;
 
+// Takes a request body piece by piece as it arrives, so uploads of any size
+// pass through without being buffered. One per request.
+class BodySink {
+public:
+    virtual ~BodySink() = default;
+    virtual void write(std::string_view piece) = 0;
+    // After the last piece
+    virtual Response finish() = 0;
+};
+
+// Called once the head has arrived. The request's views are gone by the
+// time the body is done: copy out what finish() needs.
+using StreamHandler = std::function<std::unique_ptr<BodySink>(const Request&)>;
+
+// Where a handler runs. Inline handlers run on the connection's ring; Offload
+// handlers run on the server's worker pool while the ring serves other
+// connections, for handlers that do enough CPU work to stall it.
+enum class Dispatch {
+    Inline,
+    Offload
+};
+
+// Either `handler`, which gets the body buffered in Request::body, or
+// `stream`, which gets it through a BodySink (always inline)
+struct Route {
+    Handler handler;
+    Dispatch dispatch = Dispatch::Inline;
+    StreamHandler stream;
+};
+
 class Router {
 public:
-    void add(Method method, const std::string& path, Handler handler) {
+    void add(Method method, const std::string& path, Handler handler, Dispatch dispatch = Dispatch::Inline) {
         
         std::string key = method_to_string(method) + ":" + path;
-        routes_[key] = handler;
+        routes_[key] = Route{ std::move(handler), dispatch, {} };
+        if (dispatch == Dispatch::Offload) has_offload_ = true;
     }
 
-    bool handle(const Request& req, Response& res) {
+    void add_stream(Method method, const std::string& path, StreamHandler stream) {
+        std::string key = method_to_string(method) + ":" + path;
+        routes_[key] = Route{ {}, Dispatch::Inline, std::move(stream) };
+    }
+
+    const Route* find(const Request& req) const {
         std::string key = method_to_string(req.method) + ":" + std::string(req.uri);
-        if (routes_.contains(key)) {
-            res = routes_[key](req);
-            return true;
-        }
-        return false;
+        auto it = routes_.find(key);
+        return it != routes_.end() ? &it->second : nullptr;
     }
 
+    // Runs the handler inline whatever its dispatch
+    bool handle(const Request& req, Response& res) const {
+        const Route* route = find(req);
+        if (!route) return false;
+        res = run(*route, req);
+        return true;
+    }
+
+    // A stream route is handed the whole of an already buffered body
+    static Response run(const Route& route, const Request& req) {
+        if (route.handler) return route.handler(req);
+        std::unique_ptr<BodySink> sink = route.stream(req);
+        if (!req.body.empty()) sink->write(req.body);
+        return sink->finish();
+    }
+
+    bool has_offload() const { return has_offload_; }
+
 private:
-    std::string method_to_string(Method m) {
+    static std::string method_to_string(Method m) {
         switch(m) {
             case Method::HTTP_GET: return "GET";
             case Method::HTTP_POST: return "POST";
@@ -53,7 +120,8 @@ private:
         }
     }
 
-    std::unordered_map<std::string, Handler> routes_;
+    std::unordered_map<std::string, Route> routes_;
+    bool has_offload_ = false;
 };
 
 }
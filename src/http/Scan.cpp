@@ -0,0 +1,223 @@
+#include "Scan.hpp"
+#include <bit>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define HTTP_SCAN_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define HTTP_SCAN_TARGET(isa)
+#else
+#define HTTP_SCAN_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
+
+#ifdef _MSC_VER
+#define HTTP_SCAN_INLINE __forceinline
+#else
+#define HTTP_SCAN_INLINE inline __attribute__((always_inline))
+#endif
+
+namespace http::scan {
+
+namespace {
+
+constexpr std::array<bool, 256> URI_STOP = [] {
+    std::array<bool, 256> t{};
+    for (int c = 0; c <= 0x20; ++c) t[c] = true;
+    t[0x7f] = true;
+    return t;
+}();
+
+constexpr std::array<bool, 256> VALUE_STOP = [] {
+    std::array<bool, 256> t{};
+    for (int c = 0; c < 0x20; ++c) t[c] = c != '\t';
+    t[0x7f] = true;
+    return t;
+}();
+
+HTTP_SCAN_INLINE const char* find_scalar(const char* p, const char* end, const std::array<bool, 256>& stop) {
+    while (p < end && !stop[static_cast<uint8_t>(*p)]) ++p;
+    return p;
+}
+
+const char* uri_end_scalar(const char* p, const char* end) { return find_scalar(p, end, URI_STOP); }
+const char* value_end_scalar(const char* p, const char* end) { return find_scalar(p, end, VALUE_STOP); }
+
+const char* token_end_scalar(const char* p, const char* end) {
+    while (p < end && TOKEN[static_cast<uint8_t>(*p)]) ++p;
+    return p;
+}
+
+#ifdef HTTP_SCAN_X86
+
+// SSE4.2: PCMPESTRI in range mode finds the first byte inside any of up to
+// eight [lo, hi] ranges, 16 bytes per instruction. The token ranges are the
+// ones picohttpparser uses; they also catch '|', '}' and '~', so a hit is
+// checked against the table and scanning resumes after a false stop.
+
+constexpr int RANGE_MODE = _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT;
+
+alignas(16) constexpr char URI_RANGES[16] = "\x00\x20\x7f\x7f";
+alignas(16) constexpr char VALUE_RANGES[16] = "\x00\x08\x0a\x1f\x7f\x7f";
+alignas(16) constexpr char TOKEN_RANGES[16] = { '\x00', ' ', '"', '"', '(', ')', ',', ',', '/', '/', ':', '@', '[', ']', '{', '\xff' };
+
+template <int RangesLen>
+HTTP_SCAN_TARGET("sse4.2") HTTP_SCAN_INLINE const char* find_ranges(const char* p, const char* end, const char* ranges) {
+    __m128i r = _mm_load_si128(reinterpret_cast<const __m128i*>(ranges));
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        int i = _mm_cmpestri(r, RangesLen, v, 16, RANGE_MODE);
+        if (i != 16) return p + i;
+        p += 16;
+    }
+    return p;
+}
+
+HTTP_SCAN_TARGET("sse4.2") HTTP_SCAN_INLINE const char* find_token_end(const char* p, const char* end) {
+    while (true) {
+        p = token_end_scalar(find_ranges<16>(p, end, TOKEN_RANGES), end);
+        if (p == end || !is_token(*p)) return p;
+        ++p;
+    }
+}
+
+HTTP_SCAN_TARGET("sse4.2") const char* uri_end_sse42(const char* p, const char* end) {
+    return find_scalar(find_ranges<4>(p, end, URI_RANGES), end, URI_STOP);
+}
+
+HTTP_SCAN_TARGET("sse4.2") const char* value_end_sse42(const char* p, const char* end) {
+    return find_scalar(find_ranges<6>(p, end, VALUE_RANGES), end, VALUE_STOP);
+}
+
+HTTP_SCAN_TARGET("sse4.2") const char* token_end_sse42(const char* p, const char* end) {
+    return find_token_end(p, end);
+}
+
+// AVX2: 32 bytes per step with plain compares for the control-character
+// classes, and a nibble lookup for tchar: the low nibble picks a row whose
+// bits say which high nibbles (0-7) make a tchar with it. Tails shorter than
+// a vector take the SSE4.2 path, inlined so that it is VEX-encoded too
+// (calling legacy SSE code with dirty upper halves stalls on transitions).
+
+constexpr std::array<uint8_t, 16> TOKEN_ROWS = [] {
+    std::array<uint8_t, 16> rows{};
+    for (int c = 0; c < 0x80; ++c) {
+        if (TOKEN[c]) rows[c & 0x0f] |= static_cast<uint8_t>(1u << (c >> 4));
+    }
+    return rows;
+}();
+
+HTTP_SCAN_TARGET("avx2") inline __m256i broadcast_table(const std::array<uint8_t, 16>& t) {
+    return _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(t.data())));
+}
+
+HTTP_SCAN_TARGET("avx2") const char* uri_end_avx2(const char* p, const char* end) {
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v); // v <= 0x20
+        __m256i stop = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, del));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(stop));
+        if (mask) return p + std::countr_zero(mask);
+        p += 32;
+    }
+    return find_scalar(find_ranges<4>(p, end, URI_RANGES), end, URI_STOP);
+}
+
+HTTP_SCAN_TARGET("avx2") const char* value_end_avx2(const char* p, const char* end) {
+    const __m256i below_space = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(v, below_space), v); // v < 0x20
+        ctl = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), ctl);
+        __m256i stop = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, del));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(stop));
+        if (mask) return p + std::countr_zero(mask);
+        p += 32;
+    }
+    return find_scalar(find_ranges<6>(p, end, VALUE_RANGES), end, VALUE_STOP);
+}
+
+HTTP_SCAN_TARGET("avx2") const char* token_end_avx2(const char* p, const char* end) {
+    constexpr std::array<uint8_t, 16> HIGH_BITS = { 1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0 };
+    const __m256i rows = broadcast_table(TOKEN_ROWS);
+    const __m256i bits = broadcast_table(HIGH_BITS);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        __m256i row = _mm256_shuffle_epi8(rows, _mm256_and_si256(v, nibble));
+        __m256i bit = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+        __m256i stop = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256());
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(stop));
+        if (mask) return p + std::countr_zero(mask);
+        p += 32;
+    }
+    return find_token_end(p, end);
+}
+
+bool cpu_has(Isa isa) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool os_avx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6; // OSXSAVE, and the OS saves YMM state
+    __cpuidex(info, 7, 0);
+    bool avx2 = os_avx && (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    bool sse42 = __builtin_cpu_supports("sse4.2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    switch (isa) {
+        case Isa::AVX2: return avx2;
+        case Isa::SSE42: return sse42;
+        case Isa::Scalar: return true;
+    }
+    return false;
+}
+
+#endif
+
+constexpr Scanner SCALAR{ Isa::Scalar, "scalar", uri_end_scalar, token_end_scalar, value_end_scalar };
+#ifdef HTTP_SCAN_X86
+constexpr Scanner SSE42{ Isa::SSE42, "sse4.2", uri_end_sse42, token_end_sse42, value_end_sse42 };
+constexpr Scanner AVX2{ Isa::AVX2, "avx2", uri_end_avx2, token_end_avx2, value_end_avx2 };
+#endif
+
+const Scanner* lookup(Isa isa) {
+#ifdef HTTP_SCAN_X86
+    if (!cpu_has(isa)) return nullptr;
+    if (isa == Isa::AVX2) return &AVX2;
+    if (isa == Isa::SSE42) return &SSE42;
+#endif
+    return isa == Isa::Scalar ? &SCALAR : nullptr;
+}
+
+// SSE4.2 even where AVX2 is available: most header fields are shorter than
+// 32 bytes, and AVX2 only wins on long values (see BENCHMARK.md)
+const Scanner*& active() {
+    static const Scanner* s = [] {
+        const Scanner* found = lookup(Isa::SSE42);
+        return found ? found : &SCALAR;
+    }();
+    return s;
+}
+
+}
+
+const Scanner& scanner() {
+    return *active();
+}
+
+bool select(Isa isa) {
+    const Scanner* s = lookup(isa);
+    if (!s) return false;
+    active() = s;
+    return true;
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace http::scan {
+
+// tchar (RFC 9110 5.6.2): what methods and header names are made of
+inline constexpr std::array<bool, 256> TOKEN = [] {
+    std::array<bool, 256> t{};
+    for (int c = '0'; c <= '9'; ++c) t[c] = true;
+    for (int c = 'A'; c <= 'Z'; ++c) t[c] = true;
+    for (int c = 'a'; c <= 'z'; ++c) t[c] = true;
+    for (char c : std::string_view("!#$%&'*+-.^_`|~")) t[static_cast<uint8_t>(c)] = true;
+    return t;
+}();
+
+inline bool is_token(char c) { return TOKEN[static_cast<uint8_t>(c)]; }
+
+enum class Isa { Scalar, SSE42, AVX2 };
+
+// Delimiter scanners for the request line and headers. Each returns the first
+// byte in [p, end) that ends the field, or `end` when the field runs past the
+// data; the parser looks at that one byte to decide what it was.
+struct Scanner {
+    Isa isa;
+    const char* name;
+    const char* (*uri_end)(const char* p, const char* end);   // Space or a control character
+    const char* (*token_end)(const char* p, const char* end); // Anything that is not a tchar
+    const char* (*value_end)(const char* p, const char* end); // A control character other than HTAB
+};
+
+// SSE4.2 when the CPU has it, scalar otherwise; AVX2 only through select()
+const Scanner& scanner();
+
+// Forces an implementation (benchmarks, --http-scan=); false if the CPU
+// lacks it. Not thread-safe: call before any parsing starts.
+bool select(Isa isa);
+
+}
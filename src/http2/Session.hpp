@@ -1,6 +1,7 @@
 #pragma once
 #include "Frame.hpp"
 #include "Hpack.hpp"
+#include "../core/IOBuf.hpp"
 #include <unordered_map>
 #include <vector>
 #include <iostream>
@@ -11,53 +12,49 @@ namespace http2 {
 struct Stream {
     uint32_t id;
     enum State { IDLE, OPEN, HALF_CLOSED_REMOTE, HALF_CLOSED_LOCAL, CLOSED } state = IDLE;
-    std::vector<uint8_t> recv_buffer; 
+    core::IOBuf recv_buffer; 
 };
 
 class Session {
 public:
-    Session() = default;
+    explicit Session(core::BufferPool& pool) : pool_(&pool), output_buffer_(pool), pending_buffer_(pool) {}
 
-    
-    bool on_data(const uint8_t* data, size_t len) {
-        pending_buffer_.insert(pending_buffer_.end(), data, data + len);
-        
-        size_t offset = 0;
+    // Frame payloads are split off `data` by reference; only bytes that must
+    // outlive the call and are still borrowed (see IOBuf::wrap) get copied.
+    bool on_data(core::IOBuf data) {
+        pending_buffer_.append(std::move(data));
         
         if (!preface_received_) {
-            if (pending_buffer_.size() < 24) return true; 
+            if (pending_buffer_.size() < 24) {
+                pending_buffer_.own();
+                return true; 
+            }
             
             preface_received_ = true;
-            offset += 24;
+            pending_buffer_.trim_front(24);
             std::cout << "[HTTP2] Connection Preface Received" << std::endl;
         }
 
-        while (offset + FrameHeader::SIZE <= pending_buffer_.size()) {
-            FrameHeader header = FrameHeader::parse(pending_buffer_.data() + offset);
+        uint8_t raw[FrameHeader::SIZE];
+        while (pending_buffer_.copy_to(raw, FrameHeader::SIZE) == FrameHeader::SIZE) {
+            FrameHeader header = FrameHeader::parse(raw);
             uint32_t length = header.get_length();
             
-            if (offset + FrameHeader::SIZE + length > pending_buffer_.size()) {
+            if (FrameHeader::SIZE + length > pending_buffer_.size()) {
                 break; 
             }
 
-            const uint8_t* payload = pending_buffer_.data() + offset + FrameHeader::SIZE;
+            pending_buffer_.trim_front(FrameHeader::SIZE);
+            core::IOBuf payload = pending_buffer_.split(length);
             process_frame(header, payload);
-            
-            offset += FrameHeader::SIZE + length;
-        }
-        
-        if (offset > 0) {
-            pending_buffer_.erase(pending_buffer_.begin(), pending_buffer_.begin() + offset);
         }
         
+        pending_buffer_.own();
         return true;
     }
 
-    void consume_output(std::vector<char>& out) {
-        if (!output_buffer_.empty()) {
-            out.insert(out.end(), output_buffer_.begin(), output_buffer_.end());
-            output_buffer_.clear();
-        }
+    void consume_output(core::IOBuf& out) {
+        out.append(std::move(output_buffer_));
     }
 
     void send_settings() {
@@ -72,26 +69,28 @@ public:
 
 private:
    
-    void process_frame(const FrameHeader& header, const uint8_t* payload);
-    void handle_data(const FrameHeader& header, const uint8_t* payload);
-    void handle_headers(const FrameHeader& header, const uint8_t* payload);
-    void handle_settings(const FrameHeader& header, const uint8_t* payload);
-    void handle_ping(const FrameHeader& header, const uint8_t* payload);
-    void handle_rst_stream(const FrameHeader& header, const uint8_t* payload);
-    void handle_goaway(const FrameHeader& header, const uint8_t* payload);
+    void process_frame(const FrameHeader& header, core::IOBuf& payload);
+    void handle_data(const FrameHeader& header, core::IOBuf& payload);
+    void handle_headers(const FrameHeader& header, core::IOBuf& payload);
+    void handle_settings(const FrameHeader& header, core::IOBuf& payload);
+    void handle_ping(const FrameHeader& header, core::IOBuf& payload);
+    void handle_rst_stream(const FrameHeader& header, core::IOBuf& payload);
+    void handle_goaway(const FrameHeader& header, core::IOBuf& payload);
     void send_simple_response(uint32_t stream_id);
     void write_frame(const FrameHeader& header, const uint8_t* payload);
+    void write_frame(const FrameHeader& header, core::IOBuf payload);
     Stream& get_or_create_stream(uint32_t id);
 
     
+    core::BufferPool* pool_;
     bool preface_received_ = false;
     std::unordered_map<uint32_t, Stream> streams_;
-    std::vector<char> output_buffer_;
-    std::vector<uint8_t> pending_buffer_;
+    core::IOBuf output_buffer_;
+    core::IOBuf pending_buffer_;
 };
 
 
-inline void Session::process_frame(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::process_frame(const FrameHeader& header, core::IOBuf& payload) {
     uint32_t stream_id = header.get_stream_id();
     uint32_t length = header.get_length();
     
@@ -129,7 +128,7 @@ inline void Session::process_frame(const FrameHeader& header, const uint8_t* pay
     }
 }
 
-inline void Session::handle_settings(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::handle_settings(const FrameHeader& header, core::IOBuf& payload) {
     if (header.flags & Flags::ACK) return;
     
     FrameHeader ack;
@@ -140,15 +139,15 @@ inline void Session::handle_settings(const FrameHeader& header, const uint8_t* p
     write_frame(ack, nullptr);
 }
 
-inline void Session::handle_ping(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::handle_ping(const FrameHeader& header, core::IOBuf& payload) {
     if (header.flags & Flags::ACK) return;
    
     FrameHeader pong = header;
     pong.flags = Flags::ACK;
-    write_frame(pong, payload);
+    write_frame(pong, std::move(payload));
 }
 
-inline void Session::handle_headers(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::handle_headers(const FrameHeader& header, core::IOBuf& payload) {
     uint32_t stream_id = header.get_stream_id();
     Stream& stream = get_or_create_stream(stream_id);
     stream.state = Stream::OPEN;
@@ -156,12 +155,13 @@ inline void Session::handle_headers(const FrameHeader& header, const uint8_t* pa
     send_simple_response(stream_id);
 }
 
-inline void Session::handle_data(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::handle_data(const FrameHeader& header, core::IOBuf& payload) {
     uint32_t stream_id = header.get_stream_id();
     uint32_t length = header.get_length();
     Stream& stream = get_or_create_stream(stream_id);
     if (length > 0) {
-        stream.recv_buffer.insert(stream.recv_buffer.end(), payload, payload + length);
+        stream.recv_buffer.append(std::move(payload));
+        stream.recv_buffer.own();
     }
     
     if (header.flags & Flags::END_STREAM) {
@@ -169,11 +169,12 @@ inline void Session::handle_data(const FrameHeader& header, const uint8_t* paylo
     }
 }
 
-inline void Session::handle_rst_stream(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::handle_rst_stream(const FrameHeader& header, core::IOBuf& payload) {
     uint32_t stream_id = header.get_stream_id();
     uint32_t error_code = 0;
-    if (header.get_length() >= 4) {
-        error_code = (payload[0] << 24) | (payload[1] << 16) | (payload[2] << 8) | payload[3];
+    uint8_t code[4];
+    if (payload.copy_to(code, 4) == 4) {
+        error_code = (code[0] << 24) | (code[1] << 16) | (code[2] << 8) | code[3];
     }
     
     std::cout << "[HTTP2] RST_STREAM Stream=" << stream_id << " ErrorCode=" << error_code << "\n";
@@ -212,29 +213,29 @@ inline void Session::send_simple_response(uint32_t stream_id) {
     write_frame(d, (const uint8_t*)body.data());
 }
 
-inline void Session::handle_goaway(const FrameHeader& header, const uint8_t* payload) {
+inline void Session::handle_goaway(const FrameHeader& header, core::IOBuf& payload) {
    
 }
 
 inline void Session::write_frame(const FrameHeader& header, const uint8_t* payload) {
     uint8_t buf[9];
     header.encode(buf); 
-    
-    for (size_t i = 0; i < 9; ++i) {
-        output_buffer_.push_back(static_cast<char>(buf[i]));
-    }
+    output_buffer_.append(buf, sizeof(buf));
     
     uint32_t length = header.get_length();
     if (length > 0 && payload) {
-        for (size_t i = 0; i < length; ++i) {
-            output_buffer_.push_back(static_cast<char>(payload[i]));
-        }
+        output_buffer_.append(payload, length);
     }
 }
 
+inline void Session::write_frame(const FrameHeader& header, core::IOBuf payload) {
+    write_frame(header, nullptr);
+    output_buffer_.append(std::move(payload));
+}
+
 inline Stream& Session::get_or_create_stream(uint32_t id) {
     if (!streams_.contains(id)) {
-        streams_[id] = Stream{id};
+        streams_.emplace(id, Stream{id, Stream::IDLE, core::IOBuf(*pool_)});
     }
     return streams_[id];
 }
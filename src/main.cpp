@@ -1,10 +1,144 @@
 #include "core/Server.hpp"
+#include "http/Scan.hpp"
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <atomic>
+#ifdef PLATFORM_LINUX
+#include <csignal>
+#endif
 
-int main() {
+// Delimiter scanner for the HTTP/1.1 parser: sse4.2 (default), avx2 or scalar
+static void select_scanner(const std::string& name) {
+    http::scan::Isa isa;
+    if (name == "avx2") isa = http::scan::Isa::AVX2;
+    else if (name == "sse4.2") isa = http::scan::Isa::SSE42;
+    else if (name == "scalar") isa = http::scan::Isa::Scalar;
+    else {
+        std::cerr << "Ignoring unknown HTTP scanner: " << name << "\n";
+        return;
+    }
+    if (!http::scan::select(isa)) std::cerr << "HTTP scanner " << name << " is not supported by this CPU\n";
+}
+
+static void parse_args(int argc, char** argv, core::ServerConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        auto value = [&](std::string_view prefix) { return std::string(arg.substr(prefix.size())); };
+
+        if (arg.starts_with("--port=")) config.port = std::stoi(value("--port="));
+        else if (arg.starts_with("--shards=")) config.shards = std::stoul(value("--shards="));
+        else if (arg == "--no-pin") config.pin_threads = false;
+        else if (arg.starts_with("--ring-entries=")) config.ring.sq_entries = std::stoul(value("--ring-entries="));
+        else if (arg.starts_with("--cq-entries=")) config.ring.cq_entries = std::stoul(value("--cq-entries="));
+        else if (arg == "--sqpoll") config.ring.sqpoll = true;
+        else if (arg.starts_with("--sqpoll-idle=")) config.ring.sq_thread_idle_ms = std::stoul(value("--sqpoll-idle="));
+        else if (arg.starts_with("--sqpoll-cpu=")) config.ring.sq_thread_cpu = std::stoi(value("--sqpoll-cpu="));
+        else if (arg == "--single-issuer") config.ring.single_issuer = true;
+        else if (arg == "--defer-taskrun") config.ring.defer_taskrun = true;
+        else if (arg == "--coop-taskrun") config.ring.coop_taskrun = true;
+        else if (arg == "--register-ring-fd") config.ring.register_ring_fd = true;
+        else if (arg.starts_with("--direct-fds=")) config.ring.direct_descriptors = std::stoul(value("--direct-fds="));
+        else if (arg == "--fixed-buffers") config.fixed_buffers = true;
+        else if (arg == "--no-fixed-buffers") config.fixed_buffers = false;
+        else if (arg == "--huge-pages=none") config.pool_huge_pages = core::HugePages::None;
+        else if (arg == "--huge-pages=thp") config.pool_huge_pages = core::HugePages::Transparent;
+        else if (arg == "--huge-pages=explicit") config.pool_huge_pages = core::HugePages::Explicit;
+        else if (arg.starts_with("--stats-path=")) config.stats_path = value("--stats-path=");
+        else if (arg == "--no-numa") config.numa_bind = false;
+        else if (arg.starts_with("--provided-buffers=")) config.provided_buffers = std::stoul(value("--provided-buffers="));
+        else if (arg.starts_with("--keepalive-timeout=")) config.keepalive_timeout_ms = std::stoul(value("--keepalive-timeout="));
+        else if (arg.starts_with("--handshake-timeout=")) config.handshake_timeout_ms = std::stoul(value("--handshake-timeout="));
+        else if (arg.starts_with("--header-timeout=")) config.header_timeout_ms = std::stoul(value("--header-timeout="));
+        else if (arg.starts_with("--max-request-bytes=")) config.max_request_bytes = std::stoul(value("--max-request-bytes="));
+        else if (arg.starts_with("--max-body-bytes=")) config.max_body_bytes = std::stoul(value("--max-body-bytes="));
+        else if (arg.starts_with("--max-batch-bytes=")) config.max_batch_bytes = std::stoul(value("--max-batch-bytes="));
+        else if (arg.starts_with("--zero-copy-threshold=")) config.zero_copy_threshold = std::stoul(value("--zero-copy-threshold="));
+        else if (arg.starts_with("--workers=")) config.workers = std::stoul(value("--workers="));
+        else if (arg.starts_with("--http-scan=")) select_scanner(value("--http-scan="));
+        else std::cerr << "Ignoring unknown option: " << arg << "\n";
+    }
+}
+
+// The first Ctrl+C (or SIGTERM) stops the server gracefully, the second exits at once
+#ifdef PLATFORM_LINUX
+class StopOnSignal {
+public:
+    // Blocks the signals in this thread, and so in every shard started after it
+    explicit StopOnSignal(core::Server& server) {
+        sigemptyset(&m_signals);
+        sigaddset(&m_signals, SIGINT);
+        sigaddset(&m_signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &m_signals, nullptr);
+        m_thread = std::thread([this, &server] {
+            bool stopping = false;
+            while (true) {
+                int sig = 0;
+                sigwait(&m_signals, &sig);
+                if (m_done.load(std::memory_order_acquire)) return;
+                if (stopping) _exit(1);
+                std::cout << "[Server] Stopping...\n";
+                server.stop();
+                stopping = true;
+            }
+        });
+    }
+
+    ~StopOnSignal() {
+        m_done.store(true, std::memory_order_release);
+        pthread_kill(m_thread.native_handle(), SIGTERM);
+        m_thread.join();
+    }
+
+private:
+    sigset_t m_signals;
+    std::atomic<bool> m_done{ false };
+    std::thread m_thread;
+};
+#else
+class StopOnSignal {
+public:
+    explicit StopOnSignal(core::Server& server) {
+        s_server.store(&server, std::memory_order_release);
+        SetConsoleCtrlHandler(&StopOnSignal::handler, TRUE);
+    }
+
+    ~StopOnSignal() {
+        SetConsoleCtrlHandler(&StopOnSignal::handler, FALSE);
+        s_server.store(nullptr, std::memory_order_release);
+    }
+
+private:
+    // Runs on a thread of its own
+    static BOOL WINAPI handler(DWORD type) {
+        if (type != CTRL_C_EVENT && type != CTRL_BREAK_EVENT) return FALSE;
+        if (s_stopping.exchange(true)) ExitProcess(1);
+        std::cout << "[Server] Stopping...\n";
+        if (core::Server* server = s_server.load(std::memory_order_acquire)) server->stop();
+        return TRUE;
+    }
+
+    static inline std::atomic<core::Server*> s_server{ nullptr };
+    static inline std::atomic<bool> s_stopping{ false };
+};
+#endif
+
+int main(int argc, char** argv) {
     try {
-       
-        core::Server server(8080, "server.crt", "server.key");
+        core::ServerConfig config;
+        config.cert_file = "server.crt";
+        config.key_file = "server.key";
+        parse_args(argc, argv, config);
+
+        #ifdef PLATFORM_LINUX
+        // Gathered writes pass MSG_NOSIGNAL, but plain writes to a socket (the
+        // tail of a zero-copy send) can't: a peer that resets must not kill us
+        signal(SIGPIPE, SIG_IGN);
+        #endif
+
+        core::Server server(config);
+        StopOnSignal stop_on_signal(server);
         server.run();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << "\n";
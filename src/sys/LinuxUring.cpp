@@ -1,20 +1,137 @@
 #include "../core/Ring.hpp"
+#include "../core/BufferPool.hpp"
 #include <iostream>
 #include <stdexcept>
 #include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <sys/eventfd.h>
 
 #ifdef PLATFORM_LINUX
 
 namespace core {
 
-Ring::Ring(unsigned entries) {
-    if (io_uring_queue_init(entries, &m_ring, 0) < 0) {
+static unsigned setup_flags(RingConfig& config) {
+    if (config.sqpoll && (config.defer_taskrun || config.coop_taskrun)) {
+        std::cerr << "[Ring] DEFER_TASKRUN/COOP_TASKRUN cannot be combined with SQPOLL, ignoring them\n";
+        config.defer_taskrun = false;
+        config.coop_taskrun = false;
+    }
+    if (config.defer_taskrun) config.single_issuer = true;
+
+    unsigned flags = 0;
+    if (config.cq_entries) flags |= IORING_SETUP_CQSIZE;
+    if (config.sqpoll) {
+        flags |= IORING_SETUP_SQPOLL;
+        if (config.sq_thread_cpu >= 0) flags |= IORING_SETUP_SQ_AFF;
+    }
+    if (config.single_issuer) flags |= IORING_SETUP_SINGLE_ISSUER;
+    if (config.defer_taskrun) flags |= IORING_SETUP_DEFER_TASKRUN;
+    if (config.coop_taskrun) flags |= IORING_SETUP_COOP_TASKRUN;
+    return flags;
+}
+
+// Turns off the newest setup feature still on, so a retry can succeed on an
+// older kernel; nullptr once there is nothing left to drop. SQPOLL goes late:
+// it is old, and refused only without the privileges for it.
+static const char* drop_setup_flag(RingConfig& config) {
+    if (config.defer_taskrun) { config.defer_taskrun = false; return "DEFER_TASKRUN"; } // 6.1
+    if (config.single_issuer) { config.single_issuer = false; return "SINGLE_ISSUER"; } // 6.0
+    if (config.coop_taskrun) { config.coop_taskrun = false; return "COOP_TASKRUN"; }    // 5.19
+    if (config.sqpoll) { config.sqpoll = false; return "SQPOLL"; }
+    if (config.cq_entries) { config.cq_entries = 0; return "CQSIZE"; }                 // 5.5
+    return nullptr;
+}
+
+static std::string describe_setup_flags(unsigned flags) {
+    static constexpr std::pair<unsigned, const char*> names[] = {
+        { IORING_SETUP_CQSIZE, "CQSIZE" }, { IORING_SETUP_SQPOLL, "SQPOLL" }, { IORING_SETUP_SQ_AFF, "SQ_AFF" },
+        { IORING_SETUP_SINGLE_ISSUER, "SINGLE_ISSUER" }, { IORING_SETUP_DEFER_TASKRUN, "DEFER_TASKRUN" },
+        { IORING_SETUP_COOP_TASKRUN, "COOP_TASKRUN" },
+    };
+    std::string out;
+    for (const auto& [flag, name] : names) {
+        if (!(flags & flag)) continue;
+        if (!out.empty()) out += ' ';
+        out += name;
+    }
+    return out.empty() ? "none" : out;
+}
+
+Ring::Ring(const RingConfig& config) : m_config(config) {
+    // Older kernels reject newer setup flags, and SQPOLL may need privileges:
+    // step down one flag at a time rather than losing all of them
+    int ret;
+    unsigned flags;
+    bool stepped_down = false;
+    while (true) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        flags = setup_flags(m_config);
+        params.flags = flags;
+        params.cq_entries = m_config.cq_entries;
+        params.sq_thread_idle = m_config.sq_thread_idle_ms;
+        params.sq_thread_cpu = m_config.sq_thread_cpu >= 0 ? m_config.sq_thread_cpu : 0;
+
+        ret = io_uring_queue_init_params(m_config.sq_entries, &m_ring, &params);
+        if (ret >= 0) break;
+        const char* dropped = drop_setup_flag(m_config);
+        if (!dropped) break;
+        std::cerr << "[Ring] io_uring setup rejected (" << strerror(-ret) << "), retrying without " << dropped << "\n";
+        stepped_down = true;
+    }
+    if (ret < 0) {
         throw std::runtime_error("io_uring_queue_init failed");
     }
+    if (stepped_down) {
+        std::cerr << "[Ring] io_uring setup flags in use: " << describe_setup_flags(flags) << "\n";
+    }
+    m_backlog.resize(m_config.sq_entries);
+
+    if (m_config.register_ring_fd && io_uring_register_ring_fd(&m_ring) < 0) {
+        m_config.register_ring_fd = false;
+    }
+
+    if (m_config.direct_descriptors > 0) {
+        ret = io_uring_register_files_sparse(&m_ring, m_config.direct_descriptors);
+        if (ret < 0) {
+            std::cerr << "[Ring] Direct descriptors unavailable: " << strerror(-ret) << "\n";
+        }
+        m_files_registered = ret >= 0;
+    }
+
+    m_timeout_ov.user_data = this;
+    m_timeout_ov.on_complete = &Ring::on_timeout;
+
+    struct io_uring_probe* probe = io_uring_get_probe_ring(&m_ring);
+    if (probe) {
+        m_msg_ring = io_uring_opcode_supported(probe, IORING_OP_MSG_RING);
+        io_uring_free_probe(probe);
+    }
+    m_msg_ov.user_data = this;
+    m_msg_ov.on_complete = &Ring::on_wake;
+    m_msg_failed_ov.user_data = this;
+    m_msg_failed_ov.on_complete = &Ring::on_msg_failed;
+
+    // Blocking on purpose: io_uring would fail a read on a non-blocking eventfd with EAGAIN
+    m_eventfd = eventfd(0, EFD_CLOEXEC);
+    if (m_eventfd < 0) {
+        throw std::runtime_error("eventfd failed");
+    }
+    m_eventfd_ov.user_data = this;
+    m_eventfd_ov.on_complete = &Ring::on_eventfd;
+    arm_eventfd();
 }
 
 Ring::~Ring() {
+    // The blocks belong to the pool, which may already be gone; only the ring is freed
+    if (m_buf_ring) {
+        io_uring_free_buf_ring(&m_ring, m_buf_ring, m_buf_entries, BUFFER_GROUP);
+    }
     io_uring_queue_exit(&m_ring);
+    close(m_eventfd);
 }
 
 void Ring::init() {
@@ -25,92 +142,431 @@ void Ring::attach(sys::native_handle_t fd) {
    
 }
 
-void Ring::submit_read(sys::native_handle_t fd, void* buf, size_t len, sys::NativeOverlapped* ov) {
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
-    if (!sqe) {
-        std::cerr << "Ring full in submit_read\n";
+int Ring::fixed_index(const void* buf, size_t len) const {
+    if (m_fixed.empty()) return -1;
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(buf);
+    uintptr_t slab = start & ~(uintptr_t(BufferPool::SLAB_SIZE) - 1);
+    if (start + len > slab + BufferPool::SLAB_SIZE) return -1;
+
+    auto it = m_fixed.find(slab);
+    return it != m_fixed.end() ? it->second : -1;
+}
+
+struct io_uring_sqe* Ring::get_sqe() {
+    if (m_backlog_count == 0) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+        if (sqe) return sqe;
+
+        // SQ is full: hand everything queued so far to the kernel and retry
+        m_stats.sq_overflows++;
+        flush();
+        sqe = io_uring_get_sqe(&m_ring);
+        if (sqe) return sqe;
+    }
+
+    // The backlog is full too: keep submitting until the kernel takes some.
+    // It only leaves SQEs behind while the SQPOLL thread catches up or on a
+    // transient error, so this doesn't spin for long.
+    while (m_backlog_count == m_backlog.size()) {
+        flush();
+        drain_backlog();
+    }
+
+    // Park it until the next loop iteration. Once anything is parked, later
+    // requests queue behind it so submission order is preserved.
+    size_t slot = m_backlog_head + m_backlog_count;
+    if (slot >= m_backlog.size()) slot -= m_backlog.size();
+    m_backlog_count++;
+    m_stats.sqes_backlogged++;
+    m_stats.backlog_high_water = std::max<uint64_t>(m_stats.backlog_high_water, m_backlog_count);
+
+    struct io_uring_sqe* sqe = &m_backlog[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void Ring::flush() {
+    int ret = io_uring_submit(&m_ring);
+    m_stats.syscalls++;
+    if (ret > 0) m_stats.sqes_submitted += ret;
+}
+
+void Ring::drain_backlog() {
+    while (m_backlog_count > 0) {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+        if (!sqe) {
+            flush();
+            sqe = io_uring_get_sqe(&m_ring);
+            if (!sqe) return;
+        }
+        *sqe = m_backlog[m_backlog_head];
+        if (++m_backlog_head == m_backlog.size()) m_backlog_head = 0;
+        m_backlog_count--;
+    }
+}
+
+void Ring::prep_target(struct io_uring_sqe* sqe, sys::native_handle_t fd) const {
+    if (is_direct(fd)) {
+        sqe->fd = fd & ~DIRECT_FD;
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+}
+
+bool Ring::register_buffers(BufferPool& pool) {
+    // One registered buffer per slab; slabs carved later just use plain reads/writes
+    std::vector<std::span<std::byte>> regions = pool.regions();
+    std::vector<struct iovec> iovs;
+    for (const auto& region : regions) {
+        iovs.push_back({ region.data(), region.size() });
+    }
+    if (iovs.empty()) return false;
+
+    int ret = io_uring_register_buffers(&m_ring, iovs.data(), iovs.size());
+    if (ret < 0) {
+        std::cerr << "[Ring] Buffer registration failed: " << strerror(-ret) << "\n";
+        return false;
+    }
+
+    m_fixed.clear();
+    for (size_t i = 0; i < regions.size(); ++i) {
+        m_fixed.emplace(reinterpret_cast<uintptr_t>(regions[i].data()), static_cast<int>(i));
+    }
+    return true;
+}
+
+void Ring::close_socket(sys::native_handle_t fd) {
+    if (!is_direct(fd)) {
+        sys::close_socket(fd);
         return;
     }
+
+    struct io_uring_sqe* sqe = get_sqe();
+    io_uring_prep_close_direct(sqe, fd & ~DIRECT_FD);
+    io_uring_sqe_set_data(sqe, nullptr);
+}
+
+void Ring::submit_read(sys::native_handle_t fd, void* buf, size_t len, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
     
-    io_uring_prep_read(sqe, fd, buf, len, 0);
+    int index = fixed_index(buf, len);
+    if (index >= 0) {
+        io_uring_prep_read_fixed(sqe, fd, buf, len, 0, index);
+    } else {
+        io_uring_prep_read(sqe, fd, buf, len, 0);
+    }
+    prep_target(sqe, fd);
     io_uring_sqe_set_data(sqe, ov);
 }
 
 void Ring::submit_write(sys::native_handle_t fd, const void* buf, size_t len, sys::NativeOverlapped* ov) {
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
-    if (!sqe) {
-        std::cerr << "Ring full in submit_write\n";
-        return;
-    }
+    struct io_uring_sqe* sqe = get_sqe();
     
-    io_uring_prep_write(sqe, fd, buf, len, 0);
+    int index = fixed_index(buf, len);
+    if (index >= 0) {
+        io_uring_prep_write_fixed(sqe, fd, buf, len, 0, index);
+    } else {
+        io_uring_prep_write(sqe, fd, buf, len, 0);
+    }
+    prep_target(sqe, fd);
     io_uring_sqe_set_data(sqe, ov);
 }
 
-void Ring::submit_accept(sys::native_handle_t server_fd, struct sockaddr* client_addr, int* client_len, sys::NativeOverlapped* ov) {
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
-    if (!sqe) {
-        std::cerr << "Ring full in submit_accept\n";
-        return;
-    }
+void Ring::submit_writev(sys::native_handle_t fd, const sys::IoVec* iov, unsigned count, sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    // Not writev: a peer that resets mid-response must not SIGPIPE the process
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = const_cast<struct iovec*>(iov);
+    msg->msg_iovlen = count;
+    io_uring_prep_sendmsg(sqe, fd, msg, MSG_NOSIGNAL);
+    prep_target(sqe, fd);
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+void Ring::submit_sendmsg_zc(sys::native_handle_t fd, const sys::IoVec* iov, unsigned count, sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_iov = const_cast<struct iovec*>(iov);
+    msg->msg_iovlen = count;
+    io_uring_prep_sendmsg_zc(sqe, fd, msg, MSG_NOSIGNAL);
+    prep_target(sqe, fd);
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+void Ring::submit_accept(sys::native_handle_t server_fd, void* client_addr, int* client_len, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
     
     // io_uring_prep_accept takes socklen_t*
-    io_uring_prep_accept(sqe, server_fd, client_addr, (socklen_t*)client_len, 0);
+    io_uring_prep_accept(sqe, server_fd, (struct sockaddr*)client_addr, (socklen_t*)client_len, 0);
     io_uring_sqe_set_data(sqe, ov);
 }
 
-void Ring::submit_sendfile(sys::native_handle_t socket_fd, sys::os_fd_t file_fd, size_t offset, size_t count, sys::NativeOverlapped* ov) {
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
-    if (!sqe) {
-        std::cerr << "Ring full in submit_sendfile\n";
-        return;
+void Ring::submit_accept_multishot(sys::native_handle_t server_fd, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    if (m_files_registered) {
+        // The result is a slot in the registered file table, not an fd
+        io_uring_prep_multishot_accept_direct(sqe, server_fd, nullptr, nullptr, 0);
+    } else {
+        io_uring_prep_multishot_accept(sqe, server_fd, nullptr, nullptr, SOCK_CLOEXEC);
     }
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+bool Ring::register_buffer_ring(BufferPool& pool, unsigned entries) {
+    if (m_buf_ring || entries == 0 || (entries & (entries - 1)) != 0 || entries > 32768) {
+        return false;
+    }
+
+    int ret = 0;
+    m_buf_ring = io_uring_setup_buf_ring(&m_ring, entries, BUFFER_GROUP, 0, &ret);
+    if (!m_buf_ring) {
+        std::cerr << "[Ring] Provided buffer ring unavailable: " << strerror(-ret) << "\n";
+        return false;
+    }
+
+    m_buf_pool = &pool;
+    m_buf_entries = entries;
+    m_buf_addrs.assign(entries, nullptr);
+    replenish_buffers();
+    return true;
+}
+
+void Ring::submit_recv_multishot(sys::native_handle_t fd, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    io_uring_prep_recv_multishot(sqe, fd, nullptr, 0, 0);
+    prep_target(sqe, fd);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+void Ring::recycle_buffer(uint16_t bid) {
+    io_uring_buf_ring_add(m_buf_ring, m_buf_addrs[bid], BufferPool::BLOCK_SIZE, bid,
+                          io_uring_buf_ring_mask(m_buf_entries), 0);
+    io_uring_buf_ring_advance(m_buf_ring, 1);
+}
+
+void* Ring::detach_buffer(uint16_t bid) {
+    void* block = m_buf_addrs[bid];
+    m_buf_addrs[bid] = m_buf_pool->allocate();
+    if (m_buf_addrs[bid]) {
+        recycle_buffer(bid);
+    }
+    return block;
+}
+
+unsigned Ring::replenish_buffers() {
+    int mask = io_uring_buf_ring_mask(m_buf_entries);
+    unsigned added = 0;
+
+    for (unsigned bid = 0; bid < m_buf_entries; ++bid) {
+        if (m_buf_addrs[bid]) continue;
+        m_buf_addrs[bid] = m_buf_pool->allocate();
+        if (!m_buf_addrs[bid]) break;
+        io_uring_buf_ring_add(m_buf_ring, m_buf_addrs[bid], BufferPool::BLOCK_SIZE, bid, mask, added++);
+    }
+    if (added > 0) {
+        io_uring_buf_ring_advance(m_buf_ring, added);
+    }
+    return added;
+}
+
+void Ring::submit_cancel(sys::native_handle_t, sys::NativeOverlapped* target, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    io_uring_prep_cancel(sqe, target, 0);
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+void Ring::submit_sendfile(sys::os_fd_t file_fd, sys::native_handle_t socket_fd, size_t offset, size_t count, sys::NativeOverlapped* ov,
+                           const void* head, size_t head_len) {
+    if (head && head_len > 0) {
+        std::cerr << "submit_sendfile: head buffers are not supported on Linux\n";
+    }
+
+    struct io_uring_sqe* sqe = get_sqe();
     
-   
-    loff_t off = offset;
-    io_uring_prep_splice(sqe, file_fd, &off, socket_fd, -1, count, 0);
+    io_uring_prep_splice(sqe, file_fd, static_cast<int64_t>(offset), socket_fd, -1, count, 0);
     io_uring_sqe_set_data(sqe, ov);
 }
 
 void Ring::submit_recvfrom(sys::native_handle_t fd, void* buf, size_t len, struct sockaddr* addr, int* addr_len, sys::NativeOverlapped* ov) {
-    struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
-    if (!sqe) {
-        std::cerr << "Ring full in submit_recvfrom\n";
-        return;
-    }
+    struct io_uring_sqe* sqe = get_sqe();
 
   
     
     io_uring_prep_recv(sqe, fd, buf, len, 0);
+    prep_target(sqe, fd);
     io_uring_sqe_set_data(sqe, ov);
 }
 
-int Ring::process_completions(bool wait_for_completion) {
-    struct io_uring_cqe* cqe;
-    int ret;
-    
-    if (wait_for_completion) {
-        ret = io_uring_wait_cqe(&m_ring, &cqe);
+void Ring::submit_recvmsg(sys::native_handle_t fd, sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    io_uring_prep_recvmsg(sqe, fd, msg, 0);
+    prep_target(sqe, fd);
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+void Ring::submit_sendmsg(sys::native_handle_t fd, const sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    struct io_uring_sqe* sqe = get_sqe();
+
+    io_uring_prep_sendmsg(sqe, fd, msg, MSG_NOSIGNAL);
+    prep_target(sqe, fd);
+    io_uring_sqe_set_data(sqe, ov);
+}
+
+void Ring::arm_eventfd() {
+    struct io_uring_sqe* sqe = get_sqe();
+    io_uring_prep_read(sqe, m_eventfd, &m_eventfd_value, sizeof(m_eventfd_value), 0);
+    io_uring_sqe_set_data(sqe, &m_eventfd_ov);
+}
+
+void Ring::wake() {
+    Ring* from = t_current;
+    if (from && from->m_msg_ring) {
+        // Rides along with the sender's next submission; no syscall of its own
+        struct io_uring_sqe* sqe = from->get_sqe();
+        io_uring_prep_msg_ring(sqe, m_ring.ring_fd, 0, (__u64)(uintptr_t)&m_msg_ov, 0);
+        sqe->flags |= IOSQE_CQE_SKIP_SUCCESS;
+        // Only a failure completes on the sender's ring
+        io_uring_sqe_set_data(sqe, &m_msg_failed_ov);
+        return;
+    }
+
+    wake_eventfd();
+}
+
+void Ring::wake_eventfd() {
+    uint64_t one = 1;
+    if (write(m_eventfd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        std::cerr << "[Ring] eventfd wakeup failed: " << strerror(errno) << "\n";
+    }
+}
+
+void Ring::on_msg_failed(sys::NativeOverlapped* ov, int result, uint32_t) {
+    // E.g. -EOVERFLOW with the target's CQ full. m_wake_pending is still set,
+    // so no later post() would wake the target: do it through its eventfd.
+    if (result < 0) static_cast<Ring*>(ov->user_data)->wake_eventfd();
+}
+
+void Ring::on_eventfd(sys::NativeOverlapped* ov, int result, uint32_t flags) {
+    Ring* self = static_cast<Ring*>(ov->user_data);
+    if (result != -ECANCELED) {
+        self->arm_eventfd();
+    }
+    on_wake(ov, result, flags);
+}
+
+void Ring::arm_timeout() {
+    m_timers.advance(now_ms());
+    uint64_t next = m_timers.next_expiry();
+    if (next == TimerWheel::NEVER || (m_timeout_at != 0 && m_timeout_at <= next)) {
+        return;
+    }
+
+    struct io_uring_sqe* sqe = get_sqe();
+
+    uint64_t delay = next - m_timers.now();
+    m_timeout_ts.tv_sec = delay / 1000;
+    m_timeout_ts.tv_nsec = (delay % 1000) * 1000000;
+
+    if (m_timeout_at != 0) {
+        // A sooner timer was added: pull the armed timeout in rather than stacking another
+        io_uring_prep_timeout_update(sqe, &m_timeout_ts, (__u64)(uintptr_t)&m_timeout_ov, 0);
+        io_uring_sqe_set_data(sqe, nullptr);
     } else {
-        ret = io_uring_peek_cqe(&m_ring, &cqe);
+        io_uring_prep_timeout(sqe, &m_timeout_ts, 0, 0);
+        io_uring_sqe_set_data(sqe, &m_timeout_ov);
     }
-    
-    if (ret < 0) {
-        if (ret == -EAGAIN) return 0;
-        return 0; // Error
+    m_timeout_at = next;
+}
+
+void Ring::on_timeout(sys::NativeOverlapped* ov, int, uint32_t) {
+    // Expired timers are fired by the advance() at the end of the iteration
+    static_cast<Ring*>(ov->user_data)->m_timeout_at = 0;
+}
+
+int Ring::process_completions(bool wait_for_completion) {
+    m_stats.iterations++;
+    t_current = this;
+
+    if (!m_inbox.empty()) {
+        drain_inbox();
     }
-    
-    if (cqe) {
-        sys::NativeOverlapped* ov = (sys::NativeOverlapped*)io_uring_cqe_get_data(cqe);
-        if (ov && ov->user_data) {
-            ov->result = cqe->res;
-            std::coroutine_handle<>::from_address(ov->user_data).resume();
+    if (m_backlog_count > 0) {
+        drain_backlog();
+    }
+    if (!m_timers.empty()) {
+        arm_timeout();
+    }
+
+    // Don't block in the kernel if completions are already waiting to be
+    // reaped, or if parked submissions or posted messages still need a pass
+    unsigned pending = io_uring_sq_ready(&m_ring);
+    unsigned wait_nr = (wait_for_completion && m_backlog_count == 0 && m_inbox.empty() && io_uring_cq_ready(&m_ring) == 0) ? 1 : 0;
+
+    int submitted = 0;
+    if (pending > 0 || wait_nr > 0) {
+        submitted = io_uring_submit_and_wait(&m_ring, wait_nr);
+        // With SQPOLL, handing SQEs to the poller thread needs no syscall
+        if (wait_nr > 0 || !m_config.sqpoll) m_stats.syscalls++;
+        if (submitted < 0) {
+            if (submitted != -EINTR && submitted != -EAGAIN && submitted != -EBUSY) {
+                std::cerr << "io_uring_submit_and_wait failed: " << strerror(-submitted) << "\n";
+            }
+            submitted = 0;
         }
-        io_uring_cqe_seen(&m_ring, cqe);
-        return 1;
+    } else if (m_config.defer_taskrun) {
+        // Deferred task work only runs when we enter the kernel for it
+        io_uring_get_events(&m_ring);
+        m_stats.syscalls++;
     }
-    
-    return 0;
+    m_stats.sqes_submitted += submitted;
+    m_stats.last_submitted = submitted;
+
+    struct io_uring_cqe* cqes[CQE_BATCH];
+    sys::IOCompletion batch[CQE_BATCH];
+    int reaped = 0;
+
+    while (true) {
+        unsigned n = io_uring_peek_batch_cqe(&m_ring, cqes, CQE_BATCH);
+        if (n == 0) break;
+
+        // Copy out and release the CQ slots before resuming anything, so
+        // coroutines that submit more work never see a full completion queue.
+        for (unsigned i = 0; i < n; ++i) {
+            batch[i].user_data = io_uring_cqe_get_data(cqes[i]);
+            batch[i].result = cqes[i]->res;
+            batch[i].flags = cqes[i]->flags;
+        }
+        io_uring_cq_advance(&m_ring, n);
+
+        for (unsigned i = 0; i < n; ++i) {
+            sys::NativeOverlapped* ov = (sys::NativeOverlapped*)batch[i].user_data;
+            if (ov && ov->on_complete) {
+                ov->on_complete(ov, batch[i].result, batch[i].flags);
+            } else if (ov && ov->user_data) {
+                ov->result = batch[i].result;
+                std::coroutine_handle<>::from_address(ov->user_data).resume();
+            }
+        }
+
+        reaped += n;
+        if (n < CQE_BATCH) break;
+    }
+
+    if (!m_timers.empty()) {
+        m_timers.advance(now_ms());
+    }
+
+    m_stats.cqes_reaped += reaped;
+    m_stats.last_reaped = reaped;
+    return reaped;
 }
 
 }
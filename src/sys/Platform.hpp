@@ -5,22 +5,36 @@
 #include <coroutine>
 #include <optional>
 #include <span>
+#include <cstdio>
 
 #if defined(_WIN32) || defined(_WIN64)
+    #ifndef PLATFORM_WINDOWS // Also set by CMake
     #define PLATFORM_WINDOWS
+    #endif
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
     #include <winsock2.h>
     #include <ws2tcpip.h>
     #include <mswsock.h>
 #elif defined(__linux__)
+    #ifndef PLATFORM_LINUX
     #define PLATFORM_LINUX
+    #endif
     #include <unistd.h>
     #include <fcntl.h>
+    #include <sys/stat.h>
     #include <sys/socket.h>
     #include <netinet/in.h>
     #include <arpa/inet.h>
+    #include <netinet/tcp.h>
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/uio.h>
+    #include <sys/mman.h>
+    #include <dirent.h>
     #include <liburing.h>
+    // <linux/fs.h> (pulled in by liburing) defines BLOCK_SIZE, which clashes with BufferPool::BLOCK_SIZE
+    #undef BLOCK_SIZE
 #else
     #error "Unsupported Platform"
 #endif
@@ -32,11 +46,15 @@ namespace sys {
     using os_fd_t = HANDLE;
     constexpr native_handle_t INVALID_HANDLE_VALUE_NET = INVALID_SOCKET;
 
+    struct NativeOverlapped;
+    using CompletionHook = void (*)(NativeOverlapped* ov, int result, uint32_t flags);
+
     struct NativeOverlapped {
         WSAOVERLAPPED ol;
         void* user_data;
         SOCKET client_socket; 
         int result; 
+        CompletionHook on_complete = nullptr;
     };
 
 #elif defined(PLATFORM_LINUX)
@@ -44,15 +62,92 @@ namespace sys {
     using os_fd_t = int;
     constexpr native_handle_t INVALID_HANDLE_VALUE_NET = -1;
 
+    struct NativeOverlapped;
+    using CompletionHook = void (*)(NativeOverlapped* ov, int result, uint32_t flags);
+
     struct NativeOverlapped {
-        void* user_data;
-        int result;
+        void* user_data = nullptr;
+        int result = 0;
+        // When set, the ring calls this for every completion instead of
+        // resuming user_data. Multishot operations use it to queue results
+        // that arrive while their consumer is busy; user_data is then free
+        // to carry the owner. `flags` are the raw CQE flags.
+        CompletionHook on_complete = nullptr;
     };
 #endif
 
+    // One scatter/gather segment, laid out the way the OS call takes it
+#if defined(PLATFORM_WINDOWS)
+    using IoVec = WSABUF;
+    inline IoVec make_iovec(const void* data, size_t len) { return { static_cast<ULONG>(len), static_cast<char*>(const_cast<void*>(data)) }; }
+    inline char* iovec_data(const IoVec& v) { return v.buf; }
+    inline size_t iovec_size(const IoVec& v) { return v.len; }
+#else
+    using IoVec = struct iovec;
+    inline IoVec make_iovec(const void* data, size_t len) { return { const_cast<void*>(data), len }; }
+    inline char* iovec_data(const IoVec& v) { return static_cast<char*>(v.iov_base); }
+    inline size_t iovec_size(const IoVec& v) { return v.iov_len; }
+#endif
+
+    // Message header for submit_recvmsg/submit_sendmsg
+#if defined(PLATFORM_WINDOWS)
+    using MsgHdr = WSAMSG;
+#else
+    using MsgHdr = struct msghdr;
+#endif
+
     struct IOCompletion {
         int result; 
         void* user_data;
+        uint32_t flags;
     };
 
+    inline void close_socket(native_handle_t fd) {
+#if defined(PLATFORM_WINDOWS)
+        closesocket(fd);
+#else
+        close(fd);
+#endif
+    }
+
+    // Pins the calling thread to a single CPU. Returns false if the OS refused.
+    inline bool pin_current_thread(unsigned cpu) {
+#if defined(PLATFORM_WINDOWS)
+        if (cpu >= sizeof(DWORD_PTR) * 8) return false;
+        return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#endif
+    }
+
+    // NUMA node that `cpu` belongs to, or -1 if the system doesn't say
+    inline int numa_node_of_cpu(unsigned cpu) {
+#if defined(PLATFORM_WINDOWS)
+        PROCESSOR_NUMBER proc{};
+        proc.Group = static_cast<WORD>(cpu / 64);
+        proc.Number = static_cast<BYTE>(cpu % 64);
+        USHORT node = 0;
+        if (!GetNumaProcessorNodeEx(&proc, &node) || node == 0xffff) return -1;
+        return node;
+#else
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+        DIR* dir = opendir(path);
+        if (!dir) return -1;
+        int node = -1;
+        while (dirent* entry = readdir(dir)) {
+            int n;
+            if (sscanf(entry->d_name, "node%d", &n) == 1) {
+                node = n;
+                break;
+            }
+        }
+        closedir(dir);
+        return node;
+#endif
+    }
+
 }
@@ -6,13 +6,14 @@
 
 namespace core {
 
-Ring::Ring(unsigned entries) : m_iocp(NULL) {
-    (void)entries;
+Ring::Ring(const RingConfig& config) : m_config(config), m_iocp(NULL) {
     WSADATA wsaData;
     int result = WSAStartup(MAKEWORD(2, 2), &wsaData);
     if (result != 0) {
         throw std::runtime_error("WSAStartup failed");
     }
+    m_wake_ov.user_data = this;
+    m_wake_ov.on_complete = &Ring::on_wake;
 }
 
 Ring::~Ring() {
@@ -38,6 +39,8 @@ void Ring::attach(sys::native_handle_t fd) {
 }
 
 void Ring::submit_read(sys::native_handle_t fd, void* buf, size_t len, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
     ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
     
     WSABUF wsaBuf;
@@ -58,6 +61,8 @@ void Ring::submit_read(sys::native_handle_t fd, void* buf, size_t len, sys::Nati
 }
 
 void Ring::submit_write(sys::native_handle_t fd, const void* buf, size_t len, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
     ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
    
     WSABUF wsaBuf;
@@ -76,7 +81,30 @@ void Ring::submit_write(sys::native_handle_t fd, const void* buf, size_t len, sy
     }
 }
 
+void Ring::submit_writev(sys::native_handle_t fd, const sys::IoVec* iov, unsigned count, sys::MsgHdr*, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
+    ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
+
+    DWORD bytesSent = 0;
+
+    int result = WSASend(fd, const_cast<WSABUF*>(iov), count, &bytesSent, 0, &ov->ol, NULL);
+
+    if (result == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err != WSA_IO_PENDING) {
+            // std::cerr << "WSASend failed: " << err << "\n";
+        }
+    }
+}
+
+void Ring::submit_sendmsg_zc(sys::native_handle_t fd, const sys::IoVec* iov, unsigned count, sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    submit_writev(fd, iov, count, msg, ov);
+}
+
 void Ring::submit_accept(sys::native_handle_t server_fd, void* output_buffer, int* client_len, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
     (void)client_len;
     SOCKET client_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (client_socket == INVALID_SOCKET) {
@@ -114,12 +142,19 @@ void Ring::submit_accept(sys::native_handle_t server_fd, void* output_buffer, in
     }
 }
 
-void Ring::submit_sendfile(sys::os_fd_t file_fd, sys::native_handle_t socket_fd, size_t offset, size_t count, sys::NativeOverlapped* ov) {
+void Ring::submit_sendfile(sys::os_fd_t file_fd, sys::native_handle_t socket_fd, size_t offset, size_t count, sys::NativeOverlapped* ov,
+                           const void* head, size_t head_len) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
     ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
     ov->ol.Offset = static_cast<DWORD>(offset);
     ov->ol.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+    TRANSMIT_FILE_BUFFERS buffers = {};
+    buffers.Head = const_cast<void*>(head);
+    buffers.HeadLength = static_cast<DWORD>(head_len);
     
-    BOOL res = TransmitFile(socket_fd, file_fd, static_cast<DWORD>(count), 0, &ov->ol, NULL, 0);
+    BOOL res = TransmitFile(socket_fd, file_fd, static_cast<DWORD>(count), 0, &ov->ol, head_len > 0 ? &buffers : NULL, 0);
     
     if (res == FALSE) {
         int err = WSAGetLastError();
@@ -130,6 +165,8 @@ void Ring::submit_sendfile(sys::os_fd_t file_fd, sys::native_handle_t socket_fd,
 }
 
 void Ring::submit_recvfrom(sys::native_handle_t fd, void* buffer, size_t len, struct sockaddr* addr, int* addr_len, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
     ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
     
     WSABUF wsaBuf;
@@ -148,24 +185,108 @@ void Ring::submit_recvfrom(sys::native_handle_t fd, void* buffer, size_t len, st
     }
 }
 
+void Ring::submit_recvmsg(sys::native_handle_t fd, sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
+    ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
+
+    static LPFN_WSARECVMSG lpWSARecvMsg = NULL;
+    if (!lpWSARecvMsg) {
+        GUID GuidWSARecvMsg = WSAID_WSARECVMSG;
+        DWORD dwBytes;
+        WSAIoctl(fd, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                 &GuidWSARecvMsg, sizeof(GuidWSARecvMsg),
+                 &lpWSARecvMsg, sizeof(lpWSARecvMsg),
+                 &dwBytes, NULL, NULL);
+    }
+
+    int res = lpWSARecvMsg(fd, msg, NULL, &ov->ol, NULL);
+
+    if (res == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err != WSA_IO_PENDING) {
+            
+        }
+    }
+}
+
+void Ring::submit_sendmsg(sys::native_handle_t fd, const sys::MsgHdr* msg, sys::NativeOverlapped* ov) {
+    m_stats.sqes_submitted++;
+    m_stats.syscalls++;
+    ZeroMemory(&ov->ol, sizeof(WSAOVERLAPPED));
+
+    int res = WSASendMsg(fd, const_cast<WSAMSG*>(msg), 0, NULL, &ov->ol, NULL);
+
+    if (res == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err != WSA_IO_PENDING) {
+            
+        }
+    }
+}
+
+void Ring::submit_cancel(sys::native_handle_t fd, sys::NativeOverlapped* target, sys::NativeOverlapped*) {
+    m_stats.syscalls++;
+    CancelIoEx((HANDLE)fd, &target->ol);
+}
+
+void Ring::wake() {
+    ZeroMemory(&m_wake_ov.ol, sizeof(WSAOVERLAPPED));
+    PostQueuedCompletionStatus(m_iocp, 0, 0, &m_wake_ov.ol);
+}
+
+void Ring::close_socket(sys::native_handle_t fd) {
+    sys::close_socket(fd);
+}
+
 int Ring::process_completions(bool wait_for_completion) {
-    LPOVERLAPPED out_ov = NULL;
-    ULONG_PTR key = 0;
-    DWORD bytes_transferred = 0;
-    
-    BOOL res = GetQueuedCompletionStatus(m_iocp, &bytes_transferred, &key, &out_ov, wait_for_completion ? INFINITE : 0);
-    
-    if (out_ov) {
-        sys::NativeOverlapped* ov = reinterpret_cast<sys::NativeOverlapped*>(out_ov);
-        
-        if (ov->user_data) {
-             ov->result = static_cast<int>(bytes_transferred);
+    m_stats.iterations++;
+    t_current = this;
+
+    if (!m_inbox.empty()) {
+        drain_inbox();
+    }
+
+    OVERLAPPED_ENTRY entries[CQE_BATCH];
+    ULONG removed = 0;
+
+    // Timers bound the wait instead of a timeout operation
+    DWORD timeout = 0;
+    if (wait_for_completion && m_inbox.empty()) {
+        m_timers.advance(now_ms());
+        uint64_t next = m_timers.next_expiry();
+        timeout = next == TimerWheel::NEVER ? INFINITE : static_cast<DWORD>(next - m_timers.now());
+    }
+
+    // Operations are issued directly by WSARecv/WSASend, so the only thing to
+    // batch here is dequeuing: one call drains up to CQE_BATCH completions.
+    BOOL res = GetQueuedCompletionStatusEx(m_iocp, entries, CQE_BATCH, &removed, timeout, FALSE);
+    m_stats.syscalls++;
+    m_stats.last_submitted = 0;
+
+    if (!res) {
+        removed = 0;
+    }
+
+    for (ULONG i = 0; i < removed; ++i) {
+        if (!entries[i].lpOverlapped) continue;
+        sys::NativeOverlapped* ov = reinterpret_cast<sys::NativeOverlapped*>(entries[i].lpOverlapped);
+
+        if (ov->on_complete) {
+             ov->on_complete(ov, static_cast<int>(entries[i].dwNumberOfBytesTransferred), 0);
+        } else if (ov->user_data) {
+             ov->result = static_cast<int>(entries[i].dwNumberOfBytesTransferred);
              std::coroutine_handle<>::from_address(ov->user_data).resume();
         }
-        return 1;
     }
-    
-    return 0;
+
+    if (!m_timers.empty()) {
+        m_timers.advance(now_ms());
+    }
+
+    m_stats.cqes_reaped += removed;
+    m_stats.last_reaped = removed;
+    return static_cast<int>(removed);
 }
 
 }
@@ -1,8 +1,11 @@
 #pragma once
 #include <openssl/ssl.h>
 #include <openssl/err.h>
-#include <vector>
+#include "../core/IOBuf.hpp"
+#include <algorithm>
+#include <climits>
 #include <iostream>
+#include <stdexcept>
 
 namespace tls {
 
@@ -58,16 +61,16 @@ public:
     }
 
     
-    int decrypt(const void* in_data, size_t in_len, std::vector<char>& out_decrypted) {
+    // Plaintext is read straight into `out`'s tail blocks
+    int decrypt(const void* in_data, size_t in_len, core::IOBuf& out_decrypted) {
        
         feed_encrypted_data(in_data, in_len);
 
-        
-        char buf[4096];
         while (true) {
-            int read = SSL_read(m_ssl, buf, sizeof(buf));
+            std::span<char> space = out_decrypted.tail(MIN_READ);
+            int read = SSL_read(m_ssl, space.data(), (int)std::min<size_t>(space.size(), INT_MAX));
             if (read > 0) {
-                out_decrypted.insert(out_decrypted.end(), buf, buf + read);
+                out_decrypted.commit(read);
             } else {
                 int err = SSL_get_error(m_ssl, read);
                 if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
@@ -81,41 +84,47 @@ public:
     }
 
    
-    int encrypt(const void* in_data, size_t in_len, std::vector<char>& out_encrypted) {
-        if (in_len > 0) {
-            int written = SSL_write(m_ssl, in_data, (int)in_len);
+    int encrypt(const void* in_data, size_t in_len, core::IOBuf& out_encrypted) {
+        const char* ptr = static_cast<const char*>(in_data);
+        // One record at a time, so the BIO pair never fills up mid-write
+        while (in_len > 0) {
+            int chunk = (int)std::min<size_t>(in_len, MAX_RECORD);
+            int written = SSL_write(m_ssl, ptr, chunk);
             if (written <= 0) return -1;
+            ptr += written;
+            in_len -= written;
+            if (extract_encrypted_data(out_encrypted) < 0) return -1;
         }
+        return extract_encrypted_data(out_encrypted) < 0 ? -1 : 1;
+    }
 
-       
-        char buf[4096];
-        while (true) {
-            int read = BIO_read(m_wbio, buf, sizeof(buf));
-            if (read > 0) {
-                out_encrypted.insert(out_encrypted.end(), buf, buf + read);
-            } else {
-                if (BIO_should_retry(m_wbio)) break;
-                return -1;
-            }
+    int encrypt(const core::IOBuf& in, core::IOBuf& out_encrypted) {
+        for (size_t i = 0; i < in.slice_count(); ++i) {
+            std::span<const char> s = in.slice(i);
+            if (encrypt(s.data(), s.size(), out_encrypted) < 0) return -1;
         }
         return 1;
     }
     
    
-    void extract_encrypted_data(std::vector<char>& out_encrypted) {
-        char buf[4096];
+    int extract_encrypted_data(core::IOBuf& out_encrypted) {
         while (true) {
-            int read = BIO_read(m_wbio, buf, sizeof(buf));
+            std::span<char> space = out_encrypted.tail(MIN_READ);
+            int read = BIO_read(m_wbio, space.data(), (int)std::min<size_t>(space.size(), INT_MAX));
             if (read > 0) {
-                out_encrypted.insert(out_encrypted.end(), buf, buf + read);
+                out_encrypted.commit(read);
             } else {
                 if (BIO_should_retry(m_wbio)) break;
-                break;
+                return -1;
             }
         }
+        return 1;
     }
 
 private:
+    static constexpr size_t MIN_READ = 1024;
+    static constexpr size_t MAX_RECORD = 16384;
+
     SSL* m_ssl;
     BIO* m_rbio;
     BIO* m_wbio;